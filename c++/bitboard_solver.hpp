@@ -0,0 +1,994 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023  Bilal Djelassi
+
+#ifndef BITBOARD_SOLVER_HPP_INCLUDED
+#define BITBOARD_SOLVER_HPP_INCLUDED
+
+#include "compressed_keys.hpp"
+#include "huge_page_allocator.hpp"
+#include "puzzle_types.hpp"
+#include "spsc_queue.hpp"
+#include "visited_set.hpp"
+#include "worker_pool.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// Kernels have an AVX2 variant on x86-64, selected at run time when the
+// processor supports it, and a portable scalar one used otherwise, and for
+// the lanes left over by the AVX2 variant.
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BITBOARD_KERNEL_AVX2
+#include <immintrin.h>
+#endif
+
+
+// Cells on the border of a grid, and the shift moving a mask by one row.
+struct BitboardEdges
+{
+    uint64_t top;
+    uint64_t bottom;
+    uint64_t left;
+    uint64_t right;
+    int rowShift;
+};
+
+inline void legalStepsScalar(
+    uint64_t const* masks,
+    uint64_t const* others,
+    size_t count,
+    BitboardEdges const& edges,
+    uint8_t* steps)
+{
+    for (size_t index = 0; index < count; ++index) {
+        uint64_t const mask = masks[index];
+        uint64_t const other = others[index];
+
+        uint8_t const up    = (mask & edges.top)    == 0 && ((mask >> edges.rowShift) & other) == 0;
+        uint8_t const down  = (mask & edges.bottom) == 0 && ((mask << edges.rowShift) & other) == 0;
+        uint8_t const left  = (mask & edges.left)   == 0 && ((mask >> 1) & other) == 0;
+        uint8_t const right = (mask & edges.right)  == 0 && ((mask << 1) & other) == 0;
+
+        steps[index] = up | down << 1 | left << 2 | right << 3;
+    }
+}
+
+inline void xorWordsScalar(uint64_t* words, uint64_t const* deltas, size_t count)
+{
+    for (size_t index = 0; index < count; ++index)
+        words[index] ^= deltas[index];
+}
+
+#if defined(BITBOARD_KERNEL_AVX2)
+
+// Lanes of all ones, as one bit per lane spread to the low bit of one byte
+// per lane.
+__attribute__((target("avx2")))
+inline uint32_t spreadLaneBits(__m256i lanes)
+{
+    uint32_t const bits = uint32_t(_mm256_movemask_pd(_mm256_castsi256_pd(lanes)));
+    return (bits * 0x204081u) & 0x01010101u;
+}
+
+// Four lanes at a time: a step is legal if the piece is off the matching
+// border, and if the piece shifted by the step meets no other cell.
+__attribute__((target("avx2")))
+inline void legalStepsAvx2(
+    uint64_t const* masks,
+    uint64_t const* others,
+    size_t count,
+    BitboardEdges const& edges,
+    uint8_t* steps)
+{
+    __m256i const zero = _mm256_setzero_si256();
+    __m256i const top = _mm256_set1_epi64x(int64_t(edges.top));
+    __m256i const bottom = _mm256_set1_epi64x(int64_t(edges.bottom));
+    __m256i const left = _mm256_set1_epi64x(int64_t(edges.left));
+    __m256i const right = _mm256_set1_epi64x(int64_t(edges.right));
+    __m128i const rowShift = _mm_cvtsi32_si128(edges.rowShift);
+    __m128i const columnShift = _mm_cvtsi32_si128(1);
+
+    size_t index = 0;
+    for (; index + 4 <= count; index += 4) {
+        __m256i const mask = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(masks + index));
+        __m256i const other = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(others + index));
+
+        __m256i const up = _mm256_and_si256(
+            _mm256_cmpeq_epi64(_mm256_and_si256(mask, top), zero),
+            _mm256_cmpeq_epi64(_mm256_and_si256(_mm256_srl_epi64(mask, rowShift), other), zero));
+        __m256i const down = _mm256_and_si256(
+            _mm256_cmpeq_epi64(_mm256_and_si256(mask, bottom), zero),
+            _mm256_cmpeq_epi64(_mm256_and_si256(_mm256_sll_epi64(mask, rowShift), other), zero));
+        __m256i const toLeft = _mm256_and_si256(
+            _mm256_cmpeq_epi64(_mm256_and_si256(mask, left), zero),
+            _mm256_cmpeq_epi64(_mm256_and_si256(_mm256_srl_epi64(mask, columnShift), other), zero));
+        __m256i const toRight = _mm256_and_si256(
+            _mm256_cmpeq_epi64(_mm256_and_si256(mask, right), zero),
+            _mm256_cmpeq_epi64(_mm256_and_si256(_mm256_sll_epi64(mask, columnShift), other), zero));
+
+        uint32_t const packed = spreadLaneBits(up) | spreadLaneBits(down) << 1
+                              | spreadLaneBits(toLeft) << 2 | spreadLaneBits(toRight) << 3;
+        for (int lane = 0; lane < 4; ++lane)
+            steps[index + lane] = uint8_t(packed >> (8 * lane));
+    }
+    legalStepsScalar(masks + index, others + index, count - index, edges, steps + index);
+}
+
+__attribute__((target("avx2")))
+inline void xorWordsAvx2(uint64_t* words, uint64_t const* deltas, size_t count)
+{
+    size_t index = 0;
+    for (; index + 4 <= count; index += 4) {
+        __m256i* const lanes = reinterpret_cast<__m256i*>(words + index);
+        __m256i const delta = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(deltas + index));
+        _mm256_storeu_si256(lanes, _mm256_xor_si256(_mm256_loadu_si256(lanes), delta));
+    }
+    xorWordsScalar(words + index, deltas + index, count - index);
+}
+
+inline bool hasAvx2() {
+    static bool const supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+#endif  // BITBOARD_KERNEL_AVX2
+
+// For each piece mask, and the mask of all other occupied cells, computes
+// which of the steps of Step::all() are legal, bit i standing for step i.
+inline void legalSteps(
+    uint64_t const* masks,
+    uint64_t const* others,
+    size_t count,
+    BitboardEdges const& edges,
+    uint8_t* steps)
+{
+#if defined(BITBOARD_KERNEL_AVX2)
+    if (hasAvx2())
+        return legalStepsAvx2(masks, others, count, edges, steps);
+#endif
+    legalStepsScalar(masks, others, count, edges, steps);
+}
+
+// XORs each word with its delta, updating keys of a batch of children.
+inline void xorWords(uint64_t* words, uint64_t const* deltas, size_t count)
+{
+#if defined(BITBOARD_KERNEL_AVX2)
+    if (hasAvx2())
+        return xorWordsAvx2(words, deltas, count);
+#endif
+    xorWordsScalar(words, deltas, count);
+}
+
+
+struct BitboardSettings
+{
+    size_t threadsCount = 1;
+
+    // Keeps the keys of the last two levels only, sorted and compressed,
+    // along with a hash set of the level being built.  Moves being
+    // reversible, children of a level can only be found in these levels.
+    bool compressedLevels = false;
+
+    // Generates batches of children on a thread of its own, while another
+    // one inserts each batch in the visited set partition by partition of
+    // the table, then merges it.
+    bool pipelined = false;
+
+    // called at the end of each level
+    ProgressCallback progress = {};
+};
+
+// Breadth-first solver working on bitboards rather than on Grid objects.
+// A state is the anchor cell of each piece (the first cell of its shape in
+// row-major order), and its key packs, for each cell, the class of the piece
+// anchored there (pieces of a class sharing a symbol and a shape).  Keys
+// identify the same states as Cells::key(), and are updated in constant
+// time by a move, along with the key of the mirrored state.  States are
+// expanded in the same order as solvePuzzle, so solutions are identical:
+// among the shortest ones, the solution found is the smallest sequence of
+// moves, compared move by move on piece index then on Step::all() order
+// (a grid and its mirror image counting as one when using symmetry, if
+// pieces and obstacles are symmetric).
+// Blocks of parents can be expanded by the threads of a pool started once
+// per search, their children being merged in order, which leaves solutions
+// unchanged.
+template<typename Grid>
+struct BitboardSolver
+{
+    static constexpr int sizeX = Grid::sizeX;
+    static constexpr int sizeY = Grid::sizeY;
+    static constexpr int cellsCount = sizeX * sizeY;
+    static_assert(cellsCount <= 64, "bitboard solver supports grids of at most 64 cells");
+
+    static constexpr size_t MaxPiecesCount = 64;
+    static constexpr int MaxClassesCount = 7;
+    static constexpr int BitsPerCell = 3;
+    static constexpr int CellsPerWord = 64 / BitsPerCell;
+    static constexpr size_t KeyWords = (cellsCount + CellsPerWord - 1) / CellsPerWord;
+
+    using Key = std::array<uint64_t, KeyWords>;
+
+    struct KeyHash {
+        size_t operator()(Key const& key) const {
+            uint64_t hash = 0;
+            for (uint64_t word : key) {
+                hash ^= word + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+                hash ^= hash >> 31;
+                hash *= 0xbf58476d1ce4e5b9;
+            }
+            return size_t(hash ^ (hash >> 29));
+        }
+    };
+
+    // parent index and packed move (piece index << 2 | step index)
+    struct Edge {
+        uint32_t parentIndex;
+        uint8_t move;
+    };
+
+    static constexpr uint32_t NoParent = std::numeric_limits<uint32_t>::max();
+
+    BitboardSolver(Grid const& initialGrid, typename Grid::KeySymmetry symmetry, BitboardSettings const& settings = {})
+    : piecesCount(initialGrid.pieces.size())
+    , threadsCount(std::max<size_t>(settings.threadsCount, 1))
+    , compressedLevels(settings.compressedLevels)
+    , pipelined(settings.pipelined)
+    , progress(settings.progress) {
+        if (!initialGrid.validate())
+            throw std::runtime_error("initial grid is invalid");
+        if (piecesCount == 0 || piecesCount > MaxPiecesCount)
+            throw std::runtime_error("unsupported number of pieces for the bitboard solver");
+        if (compressedLevels && KeyWords != 1)
+            throw std::runtime_error("compressed levels need keys of a single word");
+
+        for (int y = 0; y < sizeY; ++y) {
+            edges.left |= cellMask(0, y);
+            edges.right |= cellMask(sizeX - 1, y);
+        }
+        for (int x = 0; x < sizeX; ++x) {
+            edges.top |= cellMask(x, 0);
+            edges.bottom |= cellMask(x, sizeY - 1);
+        }
+        edges.rowShift = sizeX;
+
+        for (auto const& obstacle : initialGrid.obstacles)
+            obstacles |= cellMask(obstacle.x, obstacle.y);
+
+        for (int cell = 0; cell < cellsCount; ++cell) {
+            fieldWord[cell] = uint8_t(cell / CellsPerWord);
+            fieldShift[cell] = uint8_t(cell % CellsPerWord * BitsPerCell);
+        }
+
+        pieces.reserve(piecesCount);
+        for (auto const& piece : initialGrid.pieces)
+            pieces.push_back(compilePiece(initialGrid, piece));
+
+        // mirrored states can only share keys if obstacles and pieces are
+        // symmetric, otherwise states are told apart from their mirror image,
+        // which still yields a shortest solution
+        useMirror = symmetry == Grid::HorizontalSymmetry && mirrorSymmetric(obstacles, sizeX)
+                 && std::all_of(pieces.begin(), pieces.end(), [](CompiledPiece const& piece) {
+                        return mirrorSymmetric(piece.shape, piece.width);
+                    });
+
+        for (size_t pieceIndex = 0; pieceIndex < piecesCount; ++pieceIndex)
+            initialAnchors[pieceIndex] = anchorOf(pieceIndex, initialGrid.pieces[pieceIndex].position);
+
+        // changes to the key and to the mirror key of each move from each
+        // anchor, within the grid
+        moveDeltas.assign(deltaIndexOf(piecesCount, 0, 0), 0);
+        for (size_t pieceIndex = 0; pieceIndex < piecesCount; ++pieceIndex)
+        for (int from = 0; from < cellsCount; ++from)
+        for (int stepIndex = 0; stepIndex < 4; ++stepIndex) {
+            int const to = from + stepDeltas[stepIndex];
+            if (to < 0 || to >= cellsCount)
+                continue;
+
+            auto const& piece = pieces[pieceIndex];
+            Key key = {};
+            Key mirrorKey = {};
+            moveField(key, piece.code, from, to);
+            if (useMirror)
+                moveField(mirrorKey, piece.code, piece.mirrorAnchors[from], piece.mirrorAnchors[to]);
+
+            uint64_t* deltas = &moveDeltas[deltaIndexOf(pieceIndex, from, stepIndex)];
+            std::copy(key.begin(), key.end(), deltas);
+            std::copy(mirrorKey.begin(), mirrorKey.end(), deltas + KeyWords);
+        }
+    }
+
+    // Finds the shortest list of moves reaching the goals, or throws if they
+    // cannot be reached.
+    std::vector<Move> solve(std::vector<PieceGoal> const& goals) {
+        std::vector<std::pair<size_t, int>> goalAnchors;
+        for (auto const& goal : goals) {
+            if (goal.pieceIndex >= piecesCount)
+                throw std::runtime_error("out of bounds piece index in goal");
+            goalAnchors.push_back({goal.pieceIndex, anchorOf(goal.pieceIndex, goal.position)});
+        }
+        auto const reachesGoals = [&](uint8_t const* anchors) {
+            for (auto const& [pieceIndex, anchor] : goalAnchors)
+                if (anchors[pieceIndex] != anchor)
+                    return false;
+            return true;
+        };
+
+        edgesList.clear();
+        visited.clear();
+        statistics = {};
+        memoryTimeline.clear();
+
+        Level current;
+        current.push(initialAnchors.data(), piecesCount, keyOf(initialAnchors.data()),
+            useMirror ? mirrorKeyOf(initialAnchors.data()) : Key{}, 0, 0);
+        edgesList.push_back({NoParent, 0});
+        Key const initialKey = canonical(current.keys[0], current.mirrorKeys[0]);
+        visited.insert(initialKey, KeyHash{}(initialKey));
+        if (compressedLevels) {
+            previousLevelKeys = {};
+            currentLevelKeys = CompressedKeys({initialKey[0]});
+            visited.clear();
+        }
+
+        if (reachesGoals(current.anchors.data()))
+            return {};
+
+        size_t const batchBlocksCount = threadsCount * BlocksPerThread;
+        batchSlots.assign(pipelined ? PipelineDepth : 1, std::vector<Expansion>(batchBlocksCount));
+        std::array<uint8_t, MaxPiecesCount> anchors;
+        Level next;
+        uint32_t goalIndex = NoParent;
+        ProgressMeter meter(progress);
+        WorkerPool pool(threadsCount);
+
+        // children are merged in the order of their parents, whichever thread
+        // generated them, so that solutions do not depend on the number of
+        // threads; tells whether the goals are reached
+        auto const mergeBatch = [&](IndexRange const& batch, std::vector<Expansion>& expansions) {
+            size_t const expansionsCount = batch.b - batch.a;
+            if (pipelined)
+                insertPartitioned(expansions, expansionsCount);
+            else
+                insertInOrder(expansions, expansionsCount);
+
+            for (size_t block = 0; block < expansionsCount; ++block) {
+                auto const& expansion = expansions[block];
+                auto const& children = expansion.children;
+                statistics.triedCount += expansion.statistics.triedCount;
+                statistics.prunedCount += expansion.statistics.prunedCount;
+                statistics.invalidCount += expansion.statistics.invalidCount;
+
+                for (size_t index = 0; index < children.size(); ++index) {
+                    if (!expansion.fresh[index]) {
+                        statistics.duplicateCount += 1;
+                        continue;
+                    }
+                    statistics.appendedCount += 1;
+
+                    if (edgesList.size() == NoParent)
+                        throw std::runtime_error("too many states for the bitboard solver");
+
+                    auto const& child = children[index];
+                    uint8_t const* parentAnchors = current.anchorsAt(child.parent, piecesCount);
+                    std::copy(parentAnchors, parentAnchors + piecesCount, anchors.begin());
+                    anchors[child.move >> 2] = child.anchor;
+
+                    edgesList.push_back({current.indices[child.parent], child.move});
+                    next.push(anchors.data(), piecesCount, child.key, child.mirrorKey,
+                        uint32_t(edgesList.size() - 1), child.move);
+
+                    if (reachesGoals(anchors.data())) {
+                        goalIndex = uint32_t(edgesList.size() - 1);
+                        return true;
+                    }
+                }
+            }
+            return false;
+        };
+
+        while (true) {
+            if (current.size() == 0)
+                throw UnsolvableError();
+
+            // the initial state is the only one not reached by a move
+            bool const hasLastMoves = current.indices[0] != 0;
+            bool const reached = expandLevel(current, hasLastMoves, pool, mergeBatch);
+
+            sampleMemory(current, next);
+            if (reached)
+                return pathTo(goalIndex);
+
+            meter.levelReached(memoryTimeline.size(), next.size(), edgesList.size(),
+                memoryTimeline.back().totalBytes());
+
+            if (compressedLevels)
+                compressLevel(next);
+            current = std::move(next);
+            next = {};
+        }
+    }
+
+    // counters of the last call to solve(), which include the moves of all
+    // parents in the block holding the goal state, whatever the threads count
+    ExpansionStatistics getStatistics() const {
+        return statistics;
+    }
+
+    // bytes held at the end of each level of the last call to solve(), the
+    // last sample being taken when the goal state is found
+    std::vector<MemoryUsage> const& getMemoryTimeline() const {
+        return memoryTimeline;
+    }
+
+    size_t peakMemoryBytes() const {
+        size_t peakBytes = 0;
+        for (auto const& usage : memoryTimeline)
+            peakBytes = std::max(peakBytes, usage.totalBytes());
+        return peakBytes;
+    }
+
+private:
+    static constexpr size_t BlockSize = 256;
+    static constexpr size_t BlocksPerThread = 4;
+    static constexpr size_t PrefetchDistance = 8;
+    static constexpr size_t PipelineDepth = 4;
+    static constexpr int PartitionBits = 8;
+    static constexpr std::array<int, 4> stepDeltas = {-sizeX, +sizeX, -1, +1};
+
+    struct CompiledPiece {
+        uint8_t code;
+        uint64_t shape;     // cells relative to the bounding box origin
+        int width;          // width of the bounding box
+        int firstX;         // column of the anchor within the bounding box
+        Vect2 offset;       // anchor relative to the piece position
+        std::array<uint8_t, 64> mirrorAnchors;
+    };
+
+    // frontier of one depth as a structure of arrays, piece anchors being
+    // stored contiguously, so that expansion streams through each array
+    struct Level {
+        HugePageVector<uint8_t> anchors;
+        HugePageVector<Key> keys;
+        HugePageVector<Key> mirrorKeys;
+        HugePageVector<uint32_t> indices;
+        HugePageVector<uint8_t> lastMoves;
+
+        size_t size() const {
+            return indices.size();
+        }
+        size_t bytes() const {
+            return anchors.capacity() * sizeof(uint8_t)
+                 + keys.capacity() * sizeof(Key)
+                 + mirrorKeys.capacity() * sizeof(Key)
+                 + indices.capacity() * sizeof(uint32_t)
+                 + lastMoves.capacity() * sizeof(uint8_t);
+        }
+        uint8_t const* anchorsAt(size_t index, size_t piecesCount) const {
+            return &anchors[index * piecesCount];
+        }
+        void push(uint8_t const* stateAnchors, size_t piecesCount,
+            Key const& key, Key const& mirrorKey, uint32_t index, uint8_t lastMove) {
+            anchors.insert(anchors.end(), stateAnchors, stateAnchors + piecesCount);
+            keys.push_back(key);
+            mirrorKeys.push_back(mirrorKey);
+            indices.push_back(index);
+            lastMoves.push_back(lastMove);
+        }
+    };
+
+    // child of a block of parents, waiting for its visited set lookup
+    struct Child {
+        Key key;
+        Key mirrorKey;
+        size_t hash;
+        uint32_t parent;    // index within the current level
+        uint8_t move;
+        uint8_t anchor;     // new anchor of the moved piece
+    };
+
+    // children of a block of parents, with buffers of the legality kernel
+    struct Expansion {
+        std::vector<uint64_t> masks;
+        std::vector<uint64_t> others;
+        std::vector<uint8_t> steps;
+        std::vector<Child> children;
+        ExpansionStatistics statistics;
+
+        // keys then mirror keys of the children, and the changes the moves
+        // make to them, as laid out in moveDeltas
+        std::vector<uint64_t> keyWords;
+        std::vector<uint64_t> deltaWords;
+
+        // with compressed levels, children found in them, and buffers
+        std::vector<uint8_t> known;
+        std::vector<uint32_t> order;
+        std::vector<uint64_t> queries;
+        std::vector<uint8_t> found;
+
+        // children whose keys were not visited yet
+        std::vector<uint8_t> fresh;
+    };
+
+    // child of a batch, by its expansion and its index there
+    struct ChildRef {
+        uint32_t block;
+        uint32_t index;
+    };
+
+    // makes a completed level the current one of the compressed levels
+    void compressLevel(Level const& level) {
+        std::vector<uint64_t> keys(level.size());
+        for (size_t index = 0; index < level.size(); ++index)
+            keys[index] = canonical(level.keys[index], level.mirrorKeys[index])[0];
+        std::sort(keys.begin(), keys.end());
+
+        previousLevelKeys = std::move(currentLevelKeys);
+        currentLevelKeys = CompressedKeys(keys);
+        visited.clear();
+    }
+
+    // flags the children found in the compressed levels, by sorting them and
+    // merging them with each level
+    void findKnownChildren(Expansion& expansion) const {
+        auto const& children = expansion.children;
+        auto& order = expansion.order;
+        auto& queries = expansion.queries;
+        auto& found = expansion.found;
+
+        order.resize(children.size());
+        for (size_t index = 0; index < children.size(); ++index)
+            order[index] = uint32_t(index);
+        std::sort(order.begin(), order.end(), [&](uint32_t lhs, uint32_t rhs) {
+            return canonical(children[lhs].key, children[lhs].mirrorKey)[0]
+                 < canonical(children[rhs].key, children[rhs].mirrorKey)[0];
+        });
+
+        queries.resize(children.size());
+        for (size_t index = 0; index < children.size(); ++index)
+            queries[index] = canonical(children[order[index]].key, children[order[index]].mirrorKey)[0];
+
+        expansion.known.assign(children.size(), false);
+        found.resize(children.size());
+        for (auto const* level : {&previousLevelKeys, &currentLevelKeys}) {
+            level->findSorted(queries.data(), queries.size(), found.data());
+            for (size_t index = 0; index < children.size(); ++index)
+                if (found[index])
+                    expansion.known[order[index]] = true;
+        }
+    }
+
+    // Expands a level batch by batch, merging each one before the next.  When
+    // pipelined, batches are generated on their own thread, up to a few ahead
+    // of this one, which merges them; slots holding batches are handed over
+    // through lock-free queues.
+    template<typename Merge>
+    bool expandLevel(Level const& current, bool hasLastMoves, WorkerPool& pool, Merge const& mergeBatch) {
+        size_t const blocksCount = (current.size() + BlockSize - 1) / BlockSize;
+        size_t const batchBlocksCount = batchSlots.front().size();
+        size_t const batchesCount = (blocksCount + batchBlocksCount - 1) / batchBlocksCount;
+        auto const batchAt = [&](size_t batchIndex) {
+            size_t const batchBegin = batchIndex * batchBlocksCount;
+            return IndexRange{batchBegin, std::min(batchBegin + batchBlocksCount, blocksCount)};
+        };
+
+        if (!pipelined) {
+            for (size_t batchIndex = 0; batchIndex < batchesCount; ++batchIndex) {
+                expandBlocks(current, hasLastMoves, batchAt(batchIndex), pool, batchSlots.front());
+                if (mergeBatch(batchAt(batchIndex), batchSlots.front()))
+                    return true;
+            }
+            return false;
+        }
+
+        constexpr size_t NoSlot = std::numeric_limits<size_t>::max();
+        SpscQueue<size_t, 2 * PipelineDepth> freeSlots;
+        SpscQueue<size_t, 2 * PipelineDepth> readySlots;
+        for (size_t slot = 0; slot < batchSlots.size(); ++slot)
+            freeSlots.push(slot);
+
+        std::atomic<bool> stopped = false;
+        std::exception_ptr error;
+
+        std::thread generator([&]() {
+            try {
+                for (size_t batchIndex = 0; batchIndex < batchesCount; ++batchIndex) {
+                    size_t slot;
+                    while (!freeSlots.pop(slot)) {
+                        if (stopped)
+                            return;
+                        std::this_thread::yield();
+                    }
+                    expandBlocks(current, hasLastMoves, batchAt(batchIndex), pool, batchSlots[slot]);
+                    readySlots.push(slot);
+                }
+            }
+            catch (...) {
+                error = std::current_exception();
+                readySlots.push(NoSlot);
+            }
+        });
+
+        bool reached = false;
+        try {
+            for (size_t batchIndex = 0; batchIndex < batchesCount; ++batchIndex) {
+                size_t slot;
+                while (!readySlots.pop(slot))
+                    std::this_thread::yield();
+                if (slot == NoSlot)
+                    break;
+
+                if (mergeBatch(batchAt(batchIndex), batchSlots[slot])) {
+                    reached = true;
+                    break;
+                }
+                freeSlots.push(slot);
+            }
+        }
+        catch (...) {
+            stopped = true;
+            generator.join();
+            throw;
+        }
+        stopped = true;
+        generator.join();
+
+        if (error)
+            std::rethrow_exception(error);
+        return reached;
+    }
+
+    // Inserts the children of a batch in the visited set in parent order,
+    // prefetching the slots of the following ones, and flags the new ones.
+    void insertInOrder(std::vector<Expansion>& expansions, size_t expansionsCount) {
+        for (size_t block = 0; block < expansionsCount; ++block) {
+            auto& expansion = expansions[block];
+            auto const& children = expansion.children;
+            expansion.fresh.assign(children.size(), false);
+
+            for (size_t index = 0; index < children.size(); ++index) {
+                if (index + PrefetchDistance < children.size())
+                    visited.prefetch(children[index + PrefetchDistance].hash);
+
+                if (compressedLevels && expansion.known[index])
+                    continue;
+                auto const& child = children[index];
+                expansion.fresh[index] = visited.insert(canonical(child.key, child.mirrorKey), child.hash);
+            }
+        }
+    }
+
+    // Inserts the children of a batch in the visited set partition by
+    // partition of the table, so that the pass goes through the table in
+    // order, and flags the new ones.  Partitioning is stable, so the child
+    // flagged for a key is still the first one in parent order.
+    void insertPartitioned(std::vector<Expansion>& expansions, size_t expansionsCount) {
+        size_t const tableMask = visited.capacity() - 1;
+        int const shift = std::max(0, std::countr_zero(visited.capacity()) - PartitionBits);
+        auto const partitionOf = [&](Child const& child) {
+            return (child.hash & tableMask) >> shift;
+        };
+
+        partitionOffsets.assign((size_t(1) << PartitionBits) + 1, 0);
+        for (size_t block = 0; block < expansionsCount; ++block) {
+            auto& expansion = expansions[block];
+            expansion.fresh.assign(expansion.children.size(), false);
+            for (size_t index = 0; index < expansion.children.size(); ++index)
+                if (!compressedLevels || !expansion.known[index])
+                    partitionOffsets[partitionOf(expansion.children[index]) + 1] += 1;
+        }
+        for (size_t partition = 1; partition < partitionOffsets.size(); ++partition)
+            partitionOffsets[partition] += partitionOffsets[partition - 1];
+
+        partitioned.resize(partitionOffsets.back());
+        for (size_t block = 0; block < expansionsCount; ++block) {
+            auto const& expansion = expansions[block];
+            for (size_t index = 0; index < expansion.children.size(); ++index)
+                if (!compressedLevels || !expansion.known[index])
+                    partitioned[partitionOffsets[partitionOf(expansion.children[index])]++] =
+                        {uint32_t(block), uint32_t(index)};
+        }
+
+        for (size_t position = 0; position < partitioned.size(); ++position) {
+            if (position + PrefetchDistance < partitioned.size()) {
+                auto const [block, index] = partitioned[position + PrefetchDistance];
+                visited.prefetch(expansions[block].children[index].hash);
+            }
+            auto const [block, index] = partitioned[position];
+            auto const& child = expansions[block].children[index];
+            expansions[block].fresh[index] = visited.insert(canonical(child.key, child.mirrorKey), child.hash);
+        }
+    }
+
+    void sampleMemory(Level const& current, Level const& next) {
+        MemoryUsage usage = {};
+        usage.keysBytes = visited.capacity() * sizeof(Key)
+                        + previousLevelKeys.bytesCount() + currentLevelKeys.bytesCount();
+        usage.edgesBytes = edgesList.capacity() * sizeof(Edge);
+        usage.nodesBytes = current.bytes() + next.bytes();
+        usage.levelsBytes = partitioned.capacity() * sizeof(ChildRef)
+                          + partitionOffsets.capacity() * sizeof(size_t);
+        for (auto const& expansions : batchSlots)
+        for (auto const& expansion : expansions)
+            usage.levelsBytes += sizeof(Expansion)
+                               + expansion.masks.capacity() * sizeof(uint64_t)
+                               + expansion.others.capacity() * sizeof(uint64_t)
+                               + expansion.steps.capacity() * sizeof(uint8_t)
+                               + expansion.children.capacity() * sizeof(Child)
+                               + expansion.keyWords.capacity() * sizeof(uint64_t)
+                               + expansion.deltaWords.capacity() * sizeof(uint64_t)
+                               + expansion.known.capacity() * sizeof(uint8_t)
+                               + expansion.order.capacity() * sizeof(uint32_t)
+                               + expansion.queries.capacity() * sizeof(uint64_t)
+                               + expansion.found.capacity() * sizeof(uint8_t)
+                               + expansion.fresh.capacity() * sizeof(uint8_t);
+        memoryTimeline.push_back(usage);
+    }
+
+    // Expands the given blocks of the current level, each one into its own
+    // expansion, spreading blocks over the threads of the pool.
+    void expandBlocks(Level const& current, bool hasLastMoves,
+        IndexRange const& blocks, WorkerPool& pool, std::vector<Expansion>& expansions) const {
+
+        size_t const blocksCount = blocks.b - blocks.a;
+        std::atomic<size_t> nextBlock = 0;
+        std::mutex errorMutex;
+        std::exception_ptr error;
+
+        auto const worker = [&]() {
+            for (size_t block = nextBlock++; block < blocksCount; block = nextBlock++) {
+                try {
+                    size_t const blockBegin = (blocks.a + block) * BlockSize;
+                    IndexRange const parents = {blockBegin, std::min(blockBegin + BlockSize, current.size())};
+                    expandBlock(current, hasLastMoves, parents, expansions[block]);
+                }
+                catch (...) {
+                    std::lock_guard lock(errorMutex);
+                    if (!error)
+                        error = std::current_exception();
+                    nextBlock = blocksCount;
+                }
+            }
+        };
+
+        pool.run(worker, blocksCount);
+
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    void expandBlock(Level const& current, bool hasLastMoves,
+        IndexRange const& parents, Expansion& expansion) const {
+
+        size_t const lanesCount = (parents.b - parents.a) * piecesCount;
+        auto& masks = expansion.masks;
+        auto& others = expansion.others;
+        auto& steps = expansion.steps;
+        auto& children = expansion.children;
+        auto& counters = expansion.statistics;
+
+        // gather piece masks of all parents, then run the legality kernel
+        // over all of them at once
+        masks.resize(lanesCount);
+        others.resize(lanesCount);
+        steps.resize(lanesCount);
+        for (size_t const parent : parents) {
+            uint8_t const* parentAnchors = current.anchorsAt(parent, piecesCount);
+            uint64_t* parentMasks = &masks[(parent - parents.a) * piecesCount];
+
+            uint64_t occupied = obstacles;
+            for (size_t pieceIndex = 0; pieceIndex < piecesCount; ++pieceIndex) {
+                parentMasks[pieceIndex] = maskOf(pieceIndex, parentAnchors[pieceIndex]);
+                occupied |= parentMasks[pieceIndex];
+            }
+            for (size_t pieceIndex = 0; pieceIndex < piecesCount; ++pieceIndex)
+                others[(parent - parents.a) * piecesCount + pieceIndex] =
+                    occupied & ~parentMasks[pieceIndex];
+        }
+        legalSteps(masks.data(), others.data(), lanesCount, edges, steps.data());
+
+        // list legal moves, gathering the keys of their parents and the
+        // changes they make to them, then update the keys of all children
+        // at once
+        auto& keyWords = expansion.keyWords;
+        auto& deltaWords = expansion.deltaWords;
+        children.clear();
+        keyWords.clear();
+        deltaWords.clear();
+        counters = {};
+        for (size_t const parent : parents) {
+            uint8_t const* parentAnchors = current.anchorsAt(parent, piecesCount);
+            uint8_t const* parentSteps = &steps[(parent - parents.a) * piecesCount];
+            Key const& parentKey = current.keys[parent];
+            Key const& parentMirrorKey = current.mirrorKeys[parent];
+
+            // steps of Step::all() come in pairs, each one undoing the other
+            int const undoingMove = hasLastMoves ? current.lastMoves[parent] ^ 1 : -1;
+            counters.triedCount += 4 * piecesCount;
+
+            for (size_t pieceIndex = 0; pieceIndex < piecesCount; ++pieceIndex)
+            for (int stepIndex = 0; stepIndex < 4; ++stepIndex) {
+                if (int(pieceIndex << 2 | stepIndex) == undoingMove) {
+                    counters.prunedCount += 1;
+                    continue;
+                }
+                if (!(parentSteps[pieceIndex] >> stepIndex & 1)) {
+                    counters.invalidCount += 1;
+                    continue;
+                }
+
+                int const from = parentAnchors[pieceIndex];
+                uint64_t const* deltas = &moveDeltas[deltaIndexOf(pieceIndex, from, stepIndex)];
+                keyWords.insert(keyWords.end(), parentKey.begin(), parentKey.end());
+                keyWords.insert(keyWords.end(), parentMirrorKey.begin(), parentMirrorKey.end());
+                deltaWords.insert(deltaWords.end(), deltas, deltas + 2 * KeyWords);
+
+                Child child;
+                child.parent = uint32_t(parent);
+                child.move = uint8_t(pieceIndex << 2 | stepIndex);
+                child.anchor = uint8_t(from + stepDeltas[stepIndex]);
+                children.push_back(child);
+            }
+        }
+
+        xorWords(keyWords.data(), deltaWords.data(), keyWords.size());
+        for (size_t index = 0; index < children.size(); ++index) {
+            auto& child = children[index];
+            uint64_t const* words = &keyWords[index * 2 * KeyWords];
+            std::copy(words, words + KeyWords, child.key.begin());
+            std::copy(words + KeyWords, words + 2 * KeyWords, child.mirrorKey.begin());
+            child.hash = KeyHash{}(canonical(child.key, child.mirrorKey));
+        }
+
+        if (compressedLevels)
+            findKnownChildren(expansion);
+    }
+
+    static constexpr uint64_t cellMask(int x, int y) {
+        return uint64_t(1) << (y * sizeX + x);
+    }
+
+    // tells whether cells within the first columns are mirror images
+    static bool mirrorSymmetric(uint64_t mask, int width) {
+        for (int y = 0; y < sizeY; ++y)
+            for (int x = 0; x < width; ++x)
+                if (bool(mask & cellMask(x, y)) != bool(mask & cellMask(width - 1 - x, y)))
+                    return false;
+        return true;
+    }
+
+    CompiledPiece compilePiece(Grid const& grid, Piece const& piece) {
+        std::vector<Vect2> cells(piece.geom.begin(), piece.geom.end());
+        if (cells.empty())
+            throw std::runtime_error("bitboard solver cannot handle empty pieces");
+        std::sort(cells.begin(), cells.end(), [](Vect2 const& lhs, Vect2 const& rhs) {
+            return lhs.y != rhs.y ? lhs.y < rhs.y : lhs.x < rhs.x;
+        });
+
+        int minX = cells.front().x;
+        int maxX = cells.front().x;
+        for (auto const& cell : cells) {
+            minX = std::min(minX, cell.x);
+            maxX = std::max(maxX, cell.x);
+        }
+        Vect2 const first = cells.front();
+        int const width = maxX - minX + 1;
+
+        CompiledPiece compiled = {};
+        compiled.offset = first;
+        compiled.width = width;
+        compiled.firstX = first.x - minX;
+        for (auto const& cell : cells)
+            compiled.shape |= cellMask(cell.x - minX, cell.y - first.y);
+
+        // pieces sharing a symbol form a class, and must share a shape
+        auto const sameSymbol = std::find_if(grid.pieces.begin(), grid.pieces.end(),
+            [&](Piece const& other) { return other.tag.symbol == piece.tag.symbol; });
+        size_t const leaderIndex = sameSymbol - grid.pieces.begin();
+        if (leaderIndex < pieces.size()) {
+            if (pieces[leaderIndex].shape != compiled.shape || pieces[leaderIndex].firstX != compiled.firstX)
+                throw std::runtime_error("pieces sharing a symbol must share a shape");
+            compiled.code = pieces[leaderIndex].code;
+        }
+        else {
+            if (classesCount == MaxClassesCount)
+                throw std::runtime_error("too many piece symbols for the bitboard solver");
+            compiled.code = uint8_t(++classesCount);
+        }
+
+        for (int anchor = 0; anchor < cellsCount; ++anchor) {
+            int const boxX = anchor % sizeX - compiled.firstX;
+            int const mirroredX = sizeX - width - boxX + compiled.firstX;
+            compiled.mirrorAnchors[anchor] = uint8_t(
+                0 <= mirroredX && mirroredX < sizeX ? anchor / sizeX * sizeX + mirroredX : anchor);
+        }
+        return compiled;
+    }
+
+    int anchorOf(size_t pieceIndex, Vect2 const& position) const {
+        Vect2 const anchor = position + pieces[pieceIndex].offset;
+        if (anchor.x < 0 || anchor.x >= sizeX || anchor.y < 0 || anchor.y >= sizeY)
+            return cellsCount;
+        return anchor.y * sizeX + anchor.x;
+    }
+
+    uint64_t maskOf(size_t pieceIndex, int anchor) const {
+        return pieces[pieceIndex].shape << (anchor - pieces[pieceIndex].firstX);
+    }
+
+    static size_t deltaIndexOf(size_t pieceIndex, int from, int stepIndex) {
+        return ((pieceIndex * cellsCount + from) * 4 + stepIndex) * 2 * KeyWords;
+    }
+
+    void moveField(Key& key, uint8_t code, int from, int to) const {
+        key[fieldWord[from]] ^= uint64_t(code) << fieldShift[from];
+        key[fieldWord[to]] ^= uint64_t(code) << fieldShift[to];
+    }
+
+    Key keyOf(uint8_t const* anchors) const {
+        Key key = {};
+        for (size_t pieceIndex = 0; pieceIndex < piecesCount; ++pieceIndex) {
+            int const anchor = anchors[pieceIndex];
+            key[fieldWord[anchor]] |= uint64_t(pieces[pieceIndex].code) << fieldShift[anchor];
+        }
+        return key;
+    }
+
+    Key mirrorKeyOf(uint8_t const* anchors) const {
+        Key key = {};
+        for (size_t pieceIndex = 0; pieceIndex < piecesCount; ++pieceIndex) {
+            int const anchor = pieces[pieceIndex].mirrorAnchors[anchors[pieceIndex]];
+            key[fieldWord[anchor]] |= uint64_t(pieces[pieceIndex].code) << fieldShift[anchor];
+        }
+        return key;
+    }
+
+    Key canonical(Key const& key, Key const& mirrorKey) const {
+        return useMirror && mirrorKey < key ? mirrorKey : key;
+    }
+
+    std::vector<Move> pathTo(uint32_t index) const {
+        auto const allSteps = Step::all();
+        std::vector<Move> path;
+        for (; edgesList[index].parentIndex != NoParent; index = edgesList[index].parentIndex) {
+            uint8_t const move = edgesList[index].move;
+            path.push_back({size_t(move >> 2), allSteps[move & 3]});
+        }
+        std::reverse(path.begin(), path.end());
+        return path;
+    }
+
+    size_t piecesCount;
+    size_t threadsCount;
+    bool compressedLevels;
+    bool pipelined;
+    ProgressCallback progress;
+    int classesCount = 0;
+    bool useMirror = false;
+    uint64_t obstacles = 0;
+    BitboardEdges edges = {};
+    std::array<uint8_t, 64> fieldWord = {};
+    std::array<uint8_t, 64> fieldShift = {};
+    std::vector<CompiledPiece> pieces;
+    std::array<uint8_t, MaxPiecesCount> initialAnchors = {};
+    std::vector<uint64_t> moveDeltas;
+
+    HugePageVector<Edge> edgesList;
+    VisitedSet<Key, KeyHash> visited;
+    std::vector<std::vector<Expansion>> batchSlots;
+    std::vector<ChildRef> partitioned;
+    std::vector<size_t> partitionOffsets;
+    CompressedKeys previousLevelKeys;
+    CompressedKeys currentLevelKeys;
+    ExpansionStatistics statistics = {};
+    std::vector<MemoryUsage> memoryTimeline;
+};
+
+#endif  // BITBOARD_SOLVER_HPP_INCLUDED
@@ -0,0 +1,118 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023  Bilal Djelassi
+
+#ifndef COMPRESSED_KEYS_HPP_INCLUDED
+#define COMPRESSED_KEYS_HPP_INCLUDED
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+
+// Sorted set of 64-bit keys stored as differences between consecutive keys,
+// each one written as a varint (7 bits per byte, high bit set on all bytes
+// but the last).  Keys are grouped in blocks, the first key of each block
+// being kept apart along with the offset of the block, so that lookups can
+// skip blocks.  The encoded bytes are position-independent, and could be
+// written to a file or mapped from one as they are.
+struct CompressedKeys
+{
+    static constexpr size_t BlockSize = 64;
+
+    CompressedKeys() = default;
+
+    // keys must be sorted and unique
+    explicit CompressedKeys(std::vector<uint64_t> const& keys)
+    : keysCount(keys.size()) {
+        for (size_t index = 0; index < keys.size(); ++index) {
+            if (index % BlockSize == 0) {
+                blockFirstKeys.push_back(keys[index]);
+                blockOffsets.push_back(bytes.size());
+                continue;
+            }
+            if (keys[index] <= keys[index - 1])
+                throw std::runtime_error("compressed keys must be sorted and unique");
+
+            for (uint64_t delta = keys[index] - keys[index - 1];; delta >>= 7) {
+                if (delta < 0x80) {
+                    bytes.push_back(uint8_t(delta));
+                    break;
+                }
+                bytes.push_back(uint8_t(delta | 0x80));
+            }
+        }
+        bytes.shrink_to_fit();
+    }
+
+    size_t size() const {
+        return keysCount;
+    }
+
+    size_t bytesCount() const {
+        return bytes.capacity()
+             + blockFirstKeys.capacity() * sizeof(uint64_t)
+             + blockOffsets.capacity() * sizeof(size_t);
+    }
+
+    // Tells which of the sorted queries are in the set, by merging them with
+    // the keys, decoding only the blocks where queries fall.
+    void findSorted(uint64_t const* queries, size_t queriesCount, uint8_t* found) const {
+        Cursor cursor(*this);
+        for (size_t index = 0; index < queriesCount; ++index)
+            found[index] = cursor.seek(queries[index]);
+    }
+
+private:
+    struct Cursor {
+        explicit Cursor(CompressedKeys const& keys)
+        : keys(keys) {}
+
+        // advances to the first key not lower than the query, queries being
+        // given in increasing order, and tells whether it equals the query
+        bool seek(uint64_t query) {
+            auto const& firstKeys = keys.blockFirstKeys;
+            if (firstKeys.empty() || query < firstKeys.front())
+                return false;
+
+            // jump to the last block starting at or before the query
+            auto const next = std::upper_bound(firstKeys.begin() + block + 1, firstKeys.end(), query);
+            size_t const queryBlock = next - firstKeys.begin() - 1;
+            if (queryBlock != block || !started) {
+                block = queryBlock;
+                started = true;
+                indexInBlock = 0;
+                offset = keys.blockOffsets[block];
+                current = firstKeys[block];
+            }
+
+            size_t const blockKeys = std::min(BlockSize, keys.keysCount - block * BlockSize);
+            while (current < query && indexInBlock + 1 < blockKeys) {
+                uint64_t delta = 0;
+                for (int shift = 0;; shift += 7) {
+                    uint8_t const byte = keys.bytes[offset++];
+                    delta |= uint64_t(byte & 0x7f) << shift;
+                    if (!(byte & 0x80))
+                        break;
+                }
+                current += delta;
+                indexInBlock += 1;
+            }
+            return current == query;
+        }
+
+        CompressedKeys const& keys;
+        size_t block = 0;
+        bool started = false;
+        size_t indexInBlock = 0;
+        size_t offset = 0;
+        uint64_t current = 0;
+    };
+
+    size_t keysCount = 0;
+    std::vector<uint8_t> bytes;
+    std::vector<uint64_t> blockFirstKeys;
+    std::vector<size_t> blockOffsets;
+};
+
+#endif  // COMPRESSED_KEYS_HPP_INCLUDED
@@ -0,0 +1,85 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023  Bilal Djelassi
+
+#ifndef HUGE_PAGE_ALLOCATOR_HPP_INCLUDED
+#define HUGE_PAGE_ALLOCATOR_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+
+// Allocator mapping large arrays directly from the system and asking for
+// transparent huge pages, which cuts TLB misses when streaming through
+// frontiers and hash tables of millions of states.  Small arrays, and all
+// arrays on other systems, use the standard allocator.
+template<typename T>
+struct HugePageAllocator
+{
+    using value_type = T;
+
+    static constexpr size_t HugePageSize = size_t(2) << 20;
+
+    HugePageAllocator() = default;
+
+    template<typename U>
+    HugePageAllocator(HugePageAllocator<U> const&) {}
+
+    T* allocate(size_t count) {
+#if defined(__linux__)
+        size_t const bytes = count * sizeof(T);
+        if (bytes >= HugePageSize) {
+            // map one huge page more than needed, then give back the slack
+            // on each side of the first huge page boundary, since only
+            // aligned huge pages can be backed by one
+            size_t const length = roundUp(bytes);
+            void* const mapped = ::mmap(nullptr, length + HugePageSize,
+                PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mapped == MAP_FAILED)
+                throw std::bad_alloc();
+            auto const start = reinterpret_cast<uintptr_t>(mapped);
+            auto const aligned = (start + HugePageSize - 1) / HugePageSize * HugePageSize;
+            if (aligned > start)
+                ::munmap(mapped, aligned - start);
+            if (size_t const tail = start + HugePageSize - aligned; tail > 0)
+                ::munmap(reinterpret_cast<void*>(aligned + length), tail);
+            void* const pointer = reinterpret_cast<void*>(aligned);
+            ::madvise(pointer, length, MADV_HUGEPAGE);
+            return static_cast<T*>(pointer);
+        }
+#endif
+        return std::allocator<T>{}.allocate(count);
+    }
+
+    void deallocate(T* pointer, size_t count) {
+#if defined(__linux__)
+        size_t const bytes = count * sizeof(T);
+        if (bytes >= HugePageSize) {
+            ::munmap(pointer, roundUp(bytes));
+            return;
+        }
+#endif
+        std::allocator<T>{}.deallocate(pointer, count);
+    }
+
+    template<typename U>
+    bool operator==(HugePageAllocator<U> const&) const {
+        return true;
+    }
+
+private:
+    static size_t roundUp(size_t bytes) {
+        return (bytes + HugePageSize - 1) / HugePageSize * HugePageSize;
+    }
+};
+
+template<typename T>
+using HugePageVector = std::vector<T, HugePageAllocator<T>>;
+
+#endif  // HUGE_PAGE_ALLOCATOR_HPP_INCLUDED
@@ -1,17 +1,36 @@
 // SPDX-License-Identifier: MIT
 // Copyright © 2023  Bilal Djelassi
 
+#include "bitboard_solver.hpp"
 #include "puzzle_types.hpp"
+#include "solution_format.hpp"
+#include "solver_daemon.hpp"
+#include "state_graph.hpp"
 #include "svg_renderer.hpp"
+#include "visited_set.hpp"
+#include "worker_pool.hpp"
 #include "xml_writer.hpp"
+#include "zobrist_hash.hpp"
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <exception>
 #include <format>
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <random>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 
@@ -23,125 +42,274 @@ struct SearchEdge
     Move move;
 };
 
-using KlotskiSearchTree =
-    SearchTree<KlotskiGrid, std::optional<SearchEdge>, std::string>;
+using KlotskiZobristHasher = ZobristHasher<KlotskiGrid>;
+
+struct HashedGrid
+{
+    KlotskiGrid grid;
+    KlotskiZobristHasher::Hashes hashes;
+    KlotskiZobristHasher::Board board;
+};
+
+inline size_t heapBytes(HashedGrid const& node) {
+    return heapBytes(node.grid);
+}
+
+using KlotskiHashedSearchTree =
+    SearchTree<HashedGrid, std::optional<SearchEdge>, KlotskiZobristHasher::Key>;
 
 struct KlotskiSolution
 {
     KlotskiGrid grid;
     std::vector<Move> path;
+    ExpansionStatistics statistics;
+    std::vector<MemoryUsage> memoryTimeline;    // sampled at the end of each level
+    size_t peakMemoryBytes;
 };
 
-KlotskiSolution solvePuzzle(
-    KlotskiGrid const& initialGrid,
-    std::function<bool (KlotskiGrid const&)> successCondition,
-    KlotskiGrid::KeySymmetry symmetry)
+// Breadth-first solver answering goal queries on the same starting grid,
+// keeping its search tree between queries.  A query first scans the states
+// already visited, in the order they were found, then expands the tree from
+// where the last query stopped, so that the solution found is the one a
+// fresh search would find.  Moves undoing the one that led to their parent
+// are pruned, and states are keyed by hashes and boards derived from their
+// parent's by the move rather than built for each child.
+struct ResumableSolver
 {
-    auto const validated = initialGrid.validate();
-    if (!validated)
-        throw std::runtime_error("initial grid is invalid");
+    ResumableSolver(
+        KlotskiGrid const& initialGrid,
+        KlotskiGrid::KeySymmetry symmetry,
+        ProgressCallback progress = {})
+    : initialGrid(initialGrid), symmetry(symmetry), meter(std::move(progress)) {
+        auto const validated = initialGrid.validate();
+        if (!validated)
+            throw std::runtime_error("initial grid is invalid");
+
+        auto const hashes = hasher.hashesOf(*validated);
+        auto const board = hasher.boardOf(*validated);
+        searchTree.append({initialGrid, hashes, board}, std::nullopt, hasher.keyOf(hashes, board, symmetry));
+    }
 
-    if (successCondition(initialGrid))
-        return { initialGrid, {} };
+    KlotskiSolution solve(std::function<bool (KlotskiGrid const&)> const& successCondition) {
+        if (auto solution = scanVisited(successCondition))
+            return std::move(*solution);
 
-    KlotskiSearchTree searchTree;
-    searchTree.append(initialGrid, std::nullopt, validated->key(symmetry));
+        size_t const movesCount = 4 * initialGrid.pieces.size();
+        while (true) {
+            if (cursor.parentIndex == searchTree.currentDepth().b) {
+                if (searchTree.depthsCount() > 0) {
+                    memoryTimeline.push_back(searchTree.getMemoryUsage());
+                    meter.levelReached(searchTree.depthsCount(), searchTree.size() - searchTree.currentDepth().b,
+                        searchTree.size(), memoryTimeline.back().totalBytes());
+                }
+                searchTree.incrementDepth();
+                if (searchTree.currentDepth().isEmpty())
+                    throw UnsolvableError();
+                cursor = {searchTree.currentDepth().a, 0};
+            }
 
-    while (true) {
-        searchTree.incrementDepth();
-        auto const indexRange = searchTree.currentDepth();
+            // loop over last reached grids, for each piece and by trying
+            // each step as a move, from the cursor on
+            for (; cursor.parentIndex < searchTree.currentDepth().b; cursor.parentIndex += 1, cursor.moveIndex = 0) {
+                auto const& parentEdge = searchTree.edgeAt(cursor.parentIndex);
+                auto const& parent = searchTree.nodeAt(cursor.parentIndex);
 
-        if (indexRange.isEmpty())
-            throw std::runtime_error("reached end of tree, no more solutions to explore");
+                while (cursor.moveIndex < movesCount) {
+                    auto const move = Move{cursor.moveIndex / 4, Step::all()[cursor.moveIndex % 4]};
+                    cursor.moveIndex += 1;
+                    statistics.triedCount += 1;
 
-        // loop over last reached grids ...
-        for (size_t const parentIndex : indexRange)
+                    if (parentEdge && move.undoes(parentEdge->move)) {
+                        statistics.prunedCount += 1;
+                        continue;
+                    }
 
-        // ... for each piece ...
-        for (size_t const pieceIndex : IndexRange{0, initialGrid.pieces.size()})
+                    auto const& piece = parent.grid.pieces[move.pieceIndex];
+                    if (!hasher.canMove(parent.board, piece, move.step)) {
+                        statistics.invalidCount += 1;
+                        continue;
+                    }
 
-        // ... and by trying each step as a move
-        for (auto const& step : Step::all()) {
-            auto const move = Move{pieceIndex, step};
-            KlotskiGrid grid = searchTree.nodeAt(parentIndex);
-            grid.apply(move);
+                    KlotskiGrid grid = parent.grid;
+                    grid.apply(move);
+
+                    auto const hashes = hasher.moved(parent.hashes, piece, move.step);
+                    auto const board = hasher.moved(parent.board, piece, move.step);
+                    if (!searchTree.append({grid, hashes, board}, SearchEdge{cursor.parentIndex, move},
+                            hasher.keyOf(hashes, board, symmetry))) {
+                        statistics.duplicateCount += 1;
+                        continue;
+                    }
+                    statistics.appendedCount += 1;
+
+                    if (successCondition(grid))
+                        return makeSolution(grid, searchTree.lastIndex());
+                }
+            }
+        }
+    }
 
-            auto const validated = grid.validate();
-            if (!validated)
-                continue;
+private:
+    // next move to try, as its parent and its index among the moves of the
+    // parent, in order of piece then of Step::all()
+    struct Cursor {
+        size_t parentIndex;
+        size_t moveIndex;
+    };
+
+    // Replays the visited states level by level, each one from its parent
+    // in the previous level, so that only two levels of grids are held.
+    std::optional<KlotskiSolution> scanVisited(
+        std::function<bool (KlotskiGrid const&)> const& successCondition) const {
 
-            auto const key = validated->key(symmetry);
-            if (!searchTree.append(grid, SearchEdge{parentIndex, move}, key))
-                continue;
+        if (successCondition(initialGrid))
+            return makeSolution(initialGrid, 0);
 
-            if (successCondition(grid)) {
-                KlotskiSolution solution = {};
-                solution.grid = grid;
+        std::vector<KlotskiGrid> previousGrids = {initialGrid};
+        IndexRange previousRange = {0, 1};
 
-                for (auto edge = searchTree.edgeAt(searchTree.lastIndex());
-                          edge != std::nullopt;
-                          edge = searchTree.edgeAt(edge->parentIndex))
-                    solution.path.push_back(edge->move);
+        // the last range is made of children appended after the last level
+        for (size_t depth = 1; previousRange.b < searchTree.size(); ++depth) {
+            IndexRange const range = depth < searchTree.depthsCount()
+                ? searchTree.depthAt(depth)
+                : IndexRange{previousRange.b, searchTree.size()};
 
-                std::reverse(solution.path.begin(), solution.path.end());
-                return solution;
+            std::vector<KlotskiGrid> grids;
+            grids.reserve(range.b - range.a);
+            for (size_t const index : range) {
+                auto const& edge = searchTree.edgeAt(index);
+                KlotskiGrid grid = previousGrids[edge->parentIndex - previousRange.a];
+                grid.apply(edge->move);
+
+                if (successCondition(grid))
+                    return makeSolution(grid, index);
+                grids.push_back(std::move(grid));
             }
+            previousGrids = std::move(grids);
+            previousRange = range;
         }
+        return std::nullopt;
     }
+
+    KlotskiSolution makeSolution(KlotskiGrid const& grid, size_t index) const {
+        KlotskiSolution solution = {};
+        solution.grid = grid;
+        solution.statistics = statistics;
+        solution.memoryTimeline = memoryTimeline;
+        solution.memoryTimeline.push_back(searchTree.getMemoryUsage());
+        solution.peakMemoryBytes = searchTree.peakMemoryBytes();
+
+        for (auto edge = searchTree.edgeAt(index);
+                  edge != std::nullopt;
+                  edge = searchTree.edgeAt(edge->parentIndex))
+            solution.path.push_back(edge->move);
+
+        std::reverse(solution.path.begin(), solution.path.end());
+        return solution;
+    }
+
+    KlotskiGrid initialGrid;
+    KlotskiGrid::KeySymmetry symmetry;
+    KlotskiZobristHasher const hasher;
+    KlotskiHashedSearchTree searchTree;
+    Cursor cursor = {0, 0};
+    ExpansionStatistics statistics = {};
+    std::vector<MemoryUsage> memoryTimeline;
+    ProgressMeter meter;
+};
+
+// single query of a ResumableSolver
+KlotskiSolution solvePuzzle(
+    KlotskiGrid const& initialGrid,
+    std::function<bool (KlotskiGrid const&)> successCondition,
+    KlotskiGrid::KeySymmetry symmetry,
+    ProgressCallback progress = {})
+{
+    return ResumableSolver(initialGrid, symmetry, std::move(progress)).solve(successCondition);
+}
+
+using KlotskiBitboardSolver = BitboardSolver<KlotskiGrid>;
+
+KlotskiSolution solvePuzzleBitboard(
+    KlotskiGrid const& initialGrid,
+    std::vector<PieceGoal> const& goals,
+    KlotskiGrid::KeySymmetry symmetry,
+    BitboardSettings const& settings = {})
+{
+    KlotskiBitboardSolver solver(initialGrid, symmetry, settings);
+    KlotskiSolution solution = {};
+    solution.path = solver.solve(goals);
+    solution.statistics = solver.getStatistics();
+    solution.memoryTimeline = solver.getMemoryTimeline();
+    solution.peakMemoryBytes = solver.peakMemoryBytes();
+    solution.grid = initialGrid;
+    for (auto const& move : solution.path)
+        solution.grid.apply(move);
+    return solution;
 }
 
 struct KlotskiSVGRenderer : public SVGRenderer<KlotskiGrid>
 {
     KlotskiSVGRenderer() {
         properties = colorfulTheme();
-        pieceDefs = {
-            { 'A', 2 * unitSize + cellGap, 2 * unitSize + cellGap },
-            { 'B', unitSize, 2 * unitSize + cellGap },
-            { 'C', 2 * unitSize + cellGap, unitSize },
-            { 'D', unitSize, unitSize },
-        };
-        stepDefs = {
-            { Step::up().vector,    "stepUp",    "M 0 -6 L -6 4 L 6 4 Z" },
-            { Step::down().vector,  "stepDown",  "M 0 6 L -6 -4 L 6 -4 Z" },
-            { Step::left().vector,  "stepLeft",  "M -6 0 L 4 -6 L 4 6 Z" },
-            { Step::right().vector, "stepRight", "M 6 0 L -4 -6 L -4 6 Z" },
-        };
+        compileTheme();
+
+        pieceDefIndices.fill(-1);
+        addPieceDef('A', 2 * unitSize + cellGap, 2 * unitSize + cellGap);
+        addPieceDef('B', unitSize, 2 * unitSize + cellGap);
+        addPieceDef('C', 2 * unitSize + cellGap, unitSize);
+        addPieceDef('D', unitSize, unitSize);
+
+        // indexed as Step::all()
+        stepDefs = {{
+            { "stepUp",    "#stepUp",    "M 0 -6 L -6 4 L 6 4 Z" },
+            { "stepDown",  "#stepDown",  "M 0 6 L -6 -4 L 6 -4 Z" },
+            { "stepLeft",  "#stepLeft",  "M -6 0 L 4 -6 L 4 6 Z" },
+            { "stepRight", "#stepRight", "M 6 0 L -4 -6 L -4 6 Z" },
+        }};
     }
 
 private:
+    // ids and references are prebuilt, Lo being the idle piece and Hi
+    // the highlighted piece about to move
     struct PieceDef {
         char symbol;
         float sizeX;
         float sizeY;
+        std::string idLo;
+        std::string idHi;
+        std::string hrefLo;
+        std::string hrefHi;
     };
     struct StepDef {
-        Vect2 vector;
         std::string id;
+        std::string href;
         std::string path;
     };
 
     std::vector<PieceDef> pieceDefs;
-    std::vector<StepDef> stepDefs;
+    std::array<int, 128> pieceDefIndices;
+    std::array<StepDef, 4> stepDefs;
+
+    void addPieceDef(char symbol, float sizeX, float sizeY) {
+        auto const id = std::format("piece{}", symbol);
+        pieceDefIndices.at(symbol) = int(pieceDefs.size());
+        pieceDefs.push_back({ symbol, sizeX, sizeY, id, id + "_", "#" + id, "#" + id + "_" });
+    }
 
 protected:
     PieceDef const& getPieceDef(char symbol) const {
-        auto iter = std::find_if(pieceDefs.cbegin(), pieceDefs.cend(),
-        [&](PieceDef const& pieceDef) {
-            return pieceDef.symbol == symbol;
-        });
-        if (iter == pieceDefs.cend())
+        auto const index = static_cast<unsigned char>(symbol);
+        if (index >= pieceDefIndices.size() || pieceDefIndices[index] < 0)
             throw std::runtime_error("cannot access requested piece definition");
-        return *iter;
+        return pieceDefs[pieceDefIndices[index]];
     }
 
-    StepDef const& getStepDef(Vect2 const& vector) const {
-        auto iter = std::find_if(stepDefs.cbegin(), stepDefs.cend(),
-        [&](StepDef const& stepDef) {
-            return stepDef.vector == vector;
-        });
-        if (iter == stepDefs.cend())
+    StepDef const& getStepDef(Step const& step) const {
+        int const index = step.index();
+        if (index < 0)
             throw std::runtime_error("cannot access requested step definition");
-        return *iter;
+        return stepDefs[index];
     }
 
     void preRender(XmlWriter& svg, KlotskiGrid const& grid) const override {
@@ -158,9 +326,9 @@ protected:
               "font-family: {};"
               "font-size: {};"
               "}}",
-               property("textColor"),
-               property("fontFamily"),
-               property("fontSize")))
+               theme.textColor,
+               theme.fontFamily,
+               theme.fontSize))
            .term();
 
         // prerender grid
@@ -168,12 +336,12 @@ protected:
            .attr("id", "grid")
            .attr("x", "0")
            .attr("y", "0")
-           .attr("width", format("{}", getGridSizeX()))
-           .attr("height", format("{}", getGridSizeY(false)))
-           .attr("rx", format("{}", borderRadius))
-           .attr("fill", property("fillColorGrid"))
-           .attr("stroke", property("strokeColorGrid"))
-           .attr("stroke-width", property("strokeWidthGrid"))
+           .attr("width", getGridSizeX())
+           .attr("height", getGridSizeY(false))
+           .attr("rx", borderRadius)
+           .attr("fill", theme.fillColorGrid)
+           .attr("stroke", theme.strokeColorGrid)
+           .attr("stroke-width", theme.strokeWidthGrid)
            .term();
 
         // if grid has obstacles, include prerendered obstacle
@@ -189,42 +357,43 @@ protected:
                   .attr("y1", "1")
                   .attr("x2", "4")
                   .attr("y2", "1")
-                  .attr("stroke", property("strokeColorGrid"))
+                  .attr("stroke", theme.strokeColorGrid)
                   .attr("stroke-width", "2")
                   .term()
                .term()
                .elem("rect")
                .attr("id", "obstacle")
-               .attr("width", format("{}", unitSize))
-               .attr("height", format("{}", unitSize))
-               .attr("rx", format("{}", borderRadius))
+               .attr("width", unitSize)
+               .attr("height", unitSize)
+               .attr("rx", borderRadius)
                .attr("fill", "use(#hachures)")
                .term();
         }
 
         // prerender pieces and steps
         for (auto const& pieceDef : pieceDefs) {
+            PieceColors const& colors = pieceColors(pieceDef.symbol);
             svg.elem("rect")
-               .attr("id", format("piece{}", pieceDef.symbol))
+               .attr("id", pieceDef.idLo)
                .attr("x", "0")
                .attr("y", "0")
-               .attr("width", format("{}", pieceDef.sizeX))
-               .attr("height", format("{}", pieceDef.sizeY))
-               .attr("rx", format("{}", borderRadius))
-               .attr("fill", property(format("fillColorLoPiece{}", pieceDef.symbol)))
-               .attr("stroke", property(format("strokeColorLoPiece{}", pieceDef.symbol)))
-               .attr("stroke-width", property("strokeWidthPiece"))
+               .attr("width", pieceDef.sizeX)
+               .attr("height", pieceDef.sizeY)
+               .attr("rx", borderRadius)
+               .attr("fill", colors.fillLo)
+               .attr("stroke", colors.strokeLo)
+               .attr("stroke-width", theme.strokeWidthPiece)
                .term()
                .elem("rect")
-               .attr("id", format("piece{}_", pieceDef.symbol))
+               .attr("id", pieceDef.idHi)
                .attr("x", "0")
                .attr("y", "0")
-               .attr("width", format("{}", pieceDef.sizeX))
-               .attr("height", format("{}", pieceDef.sizeY))
-               .attr("rx", format("{}", borderRadius))
-               .attr("fill", property(format("fillColorHiPiece{}", pieceDef.symbol)))
-               .attr("stroke", property(format("strokeColorHiPiece{}", pieceDef.symbol)))
-               .attr("stroke-width", property("strokeWidthPiece"))
+               .attr("width", pieceDef.sizeX)
+               .attr("height", pieceDef.sizeY)
+               .attr("rx", borderRadius)
+               .attr("fill", colors.fillHi)
+               .attr("stroke", colors.strokeHi)
+               .attr("stroke-width", theme.strokeWidthPiece)
                .term();
         }
 
@@ -233,18 +402,16 @@ protected:
             svg.elem("path")
                .attr("id", stepDef.id)
                .attr("d", stepDef.path)
-               .attr("fill", property("arrowColor"));
+               .attr("fill", theme.arrowColor);
             if (stepScale != 1.0f)
-                svg.attr("transform", format("scale({})", stepScale));
+                svg.attr("transform", "scale(", stepScale, ")");
             svg.term();
         }
         svg.term();
     }
 
     void render(XmlWriter& svg, KlotskiGrid const&,
-        std::optional<std::string> title) const override {
-
-        using std::format;
+        std::optional<std::string_view> title) const override {
 
         svg.elem("use")
            .attr("xlink:href", "#grid")
@@ -252,8 +419,8 @@ protected:
 
         if (title) {
             svg.elem("text")
-               .attr("x", format("{}", getGridSizeX() * 0.5f))
-               .attr("y", format("{}", titleHeight * -0.5f))
+               .attr("x", getGridSizeX() * 0.5f)
+               .attr("y", titleHeight * -0.5f)
                .attr("class", "title")
                .text(title.value())
                .term();
@@ -263,42 +430,67 @@ protected:
     void render(XmlWriter& svg, Piece const& piece,
         std::optional<Step> step) const override {
 
-        using std::format;
-
-        std::string const pieceId =
-            format("piece{}{}", piece.tag.symbol, step ? "_" : "");
+        PieceDef const& pieceDef = getPieceDef(piece.tag.symbol);
 
         float const piecePosX = piecePositionToXCoord(piece.position.x);
         float const piecePosY = piecePositionToYCoord(piece.position.y);
 
         svg.elem("use")
-           .attr("xlink:href", format("#{}", pieceId))
-           .attr("transform", format("translate({} {})", piecePosX, piecePosY))
+           .attr("xlink:href", step ? pieceDef.hrefHi : pieceDef.hrefLo)
+           .attr("transform", "translate(", piecePosX, " ", piecePosY, ")")
            .term();
 
         if (step) {
-            StepDef const& stepDef = getStepDef(step->vector);
-            PieceDef const& pieceDef = getPieceDef(piece.tag.symbol);
+            StepDef const& stepDef = getStepDef(*step);
 
             float const stepPosX = piecePosX + pieceDef.sizeX * 0.5f;
             float const stepPosY = piecePosY + pieceDef.sizeY * 0.5f;
 
             svg.elem("use")
-               .attr("xlink:href", format("#{}", stepDef.id))
-               .attr("transform", format("translate({} {})", stepPosX, stepPosY))
+               .attr("xlink:href", stepDef.href)
+               .attr("transform", "translate(", stepPosX, " ", stepPosY, ")")
+               .term();
+        }
+    }
+
+    void renderAnimated(XmlWriter& svg, Piece const& piece,
+        std::vector<Keyframe> const& keyframes) const override {
+
+        PieceDef const& pieceDef = getPieceDef(piece.tag.symbol);
+
+        svg.elem("use")
+           .attr("xlink:href", pieceDef.hrefLo)
+           .attr("transform", "translate(",
+                piecePositionToXCoord(piece.position.x), " ",
+                piecePositionToYCoord(piece.position.y), ")");
+
+        for (auto const& keyframe : keyframes) {
+            svg.elem("animateTransform")
+               .attr("attributeName", "transform")
+               .attr("type", "translate")
+               .attr("from",
+                    piecePositionToXCoord(keyframe.from.x), " ",
+                    piecePositionToYCoord(keyframe.from.y))
+               .attr("to",
+                    piecePositionToXCoord(keyframe.to.x), " ",
+                    piecePositionToYCoord(keyframe.to.y))
+               .attr("begin", keyframe.begin, "s")
+               .attr("dur", animationStepDuration, "s")
+               .attr("fill", "freeze")
                .term();
         }
+        svg.term();
     }
 };
 
 
-int main(int, char*[])
-{
-    Vect2 constexpr pieceCellsA[] = { {0, 0}, {1, 0}, {0, 1}, {1, 1}, };
-    Vect2 constexpr pieceCellsB[] = { {0, 0}, {0, 1}, };
-    Vect2 constexpr pieceCellsC[] = { {0, 0}, {1, 0}, };
-    Vect2 constexpr pieceCellsD[] = { {0, 0}, };
+Vect2 constexpr pieceCellsA[] = { {0, 0}, {1, 0}, {0, 1}, {1, 1}, };
+Vect2 constexpr pieceCellsB[] = { {0, 0}, {0, 1}, };
+Vect2 constexpr pieceCellsC[] = { {0, 0}, {1, 0}, };
+Vect2 constexpr pieceCellsD[] = { {0, 0}, };
 
+KlotskiGrid makeStartingGrid()
+{
     KlotskiGrid startingGrid = {};
     startingGrid.pieces = {
         { {'A', 1}, {1, 0}, pieceCellsA, },
@@ -312,37 +504,1075 @@ int main(int, char*[])
         { {'D', 3}, {2, 3}, pieceCellsD, },
         { {'D', 4}, {3, 4}, pieceCellsD, },
     };
+    return startingGrid;
+}
+
+PieceGeom klotskiPieceGeom(char symbol)
+{
+    switch (symbol) {
+    case 'A': return pieceCellsA;
+    case 'B': return pieceCellsB;
+    case 'C': return pieceCellsC;
+    case 'D': return pieceCellsD;
+    default:
+        throw std::runtime_error(std::format("unknown piece symbol {}", symbol));
+    }
+}
+
+// Grids are written as a list of pieces separated by spaces, each piece
+// being its symbol followed by its x and y positions, e.g. "A10 B00 D34".
+// Pieces are numbered by symbol in order of appearance.
+KlotskiGrid parseGrid(std::string_view text)
+{
+    KlotskiGrid grid = {};
+    std::array<int, 128> numbers = {};
+
+    while (!text.empty()) {
+        size_t const begin = text.find_first_not_of(" \t");
+        if (begin == std::string_view::npos)
+            break;
+        size_t const end = std::min(text.find_first_of(" \t", begin), text.size());
+        auto const token = text.substr(begin, end - begin);
+        text.remove_prefix(end);
+
+        if (token.size() != 3
+         || token[1] < '0' || token[1] > '9'
+         || token[2] < '0' || token[2] > '9')
+            throw std::runtime_error(std::format("invalid piece {}", token));
+
+        char const symbol = token[0];
+        PieceGeom const geom = klotskiPieceGeom(symbol);
+        grid.pieces.push_back({
+            {symbol, ++numbers[symbol]},
+            {token[1] - '0', token[2] - '0'},
+            geom,
+        });
+    }
+    if (grid.pieces.empty())
+        throw std::runtime_error("grid has no pieces");
+    if (!grid.validate())
+        throw std::runtime_error("grid is invalid");
+    return grid;
+}
+
+std::string formatGrid(KlotskiGrid const& grid)
+{
+    std::string text;
+    for (auto const& piece : grid.pieces) {
+        if (!text.empty())
+            text.push_back(' ');
+        text += std::format("{}{}{}", piece.tag.symbol, piece.position.x, piece.position.y);
+    }
+    return text;
+}
+
+bool isSolved(KlotskiGrid const& grid)
+{
+    for (auto const& piece : grid.pieces)
+        if (piece.tag == PieceTag{'A', 1})
+            return piece.position == Vect2{1, 3};
+    return false;
+}
+
+// same goal as isSolved, for solvers working on piece indices
+std::vector<PieceGoal> solvedGoals(KlotskiGrid const& grid)
+{
+    for (size_t pieceIndex = 0; pieceIndex < grid.pieces.size(); ++pieceIndex)
+        if (grid.pieces[pieceIndex].tag == PieceTag{'A', 1})
+            return {{pieceIndex, {1, 3}}};
+    throw std::runtime_error("grid has no piece A1");
+}
+
+struct Options
+{
+    enum Mode {
+        Solve,
+        Hardest,
+        Components,
+        ReadBinary,
+        Daemon,
+        Goals,
+        CheckThreads,
+        Generate,
+        Differential,
+        BenchmarkVisited,
+        CheckVisited,
+    };
+
+    enum Engine {
+        Reference,
+        Bitboard,
+    };
+
+    Mode mode = Solve;
+    Engine engine = Reference;
+    size_t hardestCount = 10;
+    size_t componentsCount = 10;
+    size_t checkedCount = 100;
+    size_t generatedCount = 0;
+    size_t differentialCount = 0;
+    size_t benchmarkedCount = 0;
+    size_t checkedKeysCount = 0;
+    size_t minMoves = 1;
+    size_t maxMoves = std::numeric_limits<size_t>::max();
+    uint64_t seed = 1;
+    size_t sheetFrames = 0;
+    bool animated = false;
+    bool statistics = false;
+    bool compressedLevels = false;
+    bool pipelined = false;
+    bool progress = false;
+    std::string memoryTimelineFilename;
+    std::vector<std::pair<char, Vect2>> goals;
+    std::string binaryFilename;
+    std::string socketPath;
+    size_t cacheBytes = 64 << 20;
+    size_t threadsCount = std::max(1u, std::thread::hardware_concurrency());
+};
+
+Options parseOptions(std::vector<std::string_view> const& args)
+{
+    Options options;
+    for (size_t index = 0; index < args.size(); ++index) {
+        auto const& arg = args[index];
+        auto const nextArg = [&]() {
+            if (index + 1 >= args.size())
+                throw std::runtime_error(std::format("missing value after {}", arg));
+            return args[++index];
+        };
+
+        if (arg == "--engine") {
+            auto const engine = nextArg();
+            if (engine == "reference")
+                options.engine = Options::Reference;
+            else if (engine == "bitboard")
+                options.engine = Options::Bitboard;
+            else
+                throw std::runtime_error(std::format("unknown engine {}", engine));
+        }
+        else if (arg == "--hardest") {
+            options.mode = Options::Hardest;
+        }
+        else if (arg == "--hardest-count") {
+            options.hardestCount = std::stoul(std::string(nextArg()));
+        }
+        else if (arg == "--components") {
+            options.mode = Options::Components;
+        }
+        else if (arg == "--components-count") {
+            options.componentsCount = std::stoul(std::string(nextArg()));
+        }
+        else if (arg == "--sheet-frames") {
+            options.sheetFrames = std::stoul(std::string(nextArg()));
+        }
+        else if (arg == "--animated") {
+            options.animated = true;
+        }
+        else if (arg == "--statistics") {
+            options.statistics = true;
+        }
+        else if (arg == "--compress-levels") {
+            options.compressedLevels = true;
+        }
+        else if (arg == "--progress") {
+            options.progress = true;
+        }
+        else if (arg == "--pipelined") {
+            options.pipelined = true;
+        }
+        else if (arg == "--memory-timeline") {
+            options.memoryTimelineFilename = nextArg();
+        }
+        else if (arg == "--binary") {
+            options.binaryFilename = nextArg();
+        }
+        else if (arg == "--read-binary") {
+            options.mode = Options::ReadBinary;
+            options.binaryFilename = nextArg();
+        }
+        else if (arg == "--daemon") {
+            options.mode = Options::Daemon;
+            options.socketPath = nextArg();
+        }
+        else if (arg == "--cache-bytes") {
+            options.cacheBytes = std::stoul(std::string(nextArg()));
+        }
+        else if (arg == "--goal") {
+            auto const goal = nextArg();
+            if (goal.size() != 5 || goal[1] != ':' || goal[3] != ','
+             || goal[2] < '0' || goal[2] > '9' || goal[4] < '0' || goal[4] > '9')
+                throw std::runtime_error(std::format("invalid goal {}", goal));
+
+            options.mode = Options::Goals;
+            options.goals.push_back({goal[0], {goal[2] - '0', goal[4] - '0'}});
+        }
+        else if (arg == "--check-threads") {
+            options.mode = Options::CheckThreads;
+            options.checkedCount = std::stoul(std::string(nextArg()));
+        }
+        else if (arg == "--generate") {
+            options.mode = Options::Generate;
+            options.generatedCount = std::stoul(std::string(nextArg()));
+        }
+        else if (arg == "--differential") {
+            options.mode = Options::Differential;
+            options.differentialCount = std::stoul(std::string(nextArg()));
+        }
+        else if (arg == "--benchmark-visited") {
+            options.mode = Options::BenchmarkVisited;
+            options.benchmarkedCount = std::stoul(std::string(nextArg()));
+        }
+        else if (arg == "--check-visited") {
+            options.mode = Options::CheckVisited;
+            options.checkedKeysCount = std::stoul(std::string(nextArg()));
+        }
+        else if (arg == "--min-moves") {
+            options.minMoves = std::stoul(std::string(nextArg()));
+        }
+        else if (arg == "--max-moves") {
+            options.maxMoves = std::stoul(std::string(nextArg()));
+        }
+        else if (arg == "--seed") {
+            options.seed = std::stoull(std::string(nextArg()));
+        }
+        else if (arg == "--threads") {
+            options.threadsCount = std::max(1ul, std::stoul(std::string(nextArg())));
+        }
+        else {
+            throw std::runtime_error(std::format("unknown option {}", arg));
+        }
+    }
+    if (options.animated && options.sheetFrames > 0)
+        throw std::runtime_error("--animated cannot be combined with --sheet-frames");
+    return options;
+}
+
+void printUsage(std::ostream& out)
+{
+    out << "usage: klotski_solver.prg [options]\n"
+           "  (no option)            solve the starting grid, write klotski_solution.svg\n"
+           "  --engine NAME          solver engine, reference (default) or bitboard\n"
+           "  --hardest              report the hardest positions reachable from the\n"
+           "                         starting grid and the distribution of optimal moves\n"
+           "  --hardest-count N      number of hardest positions to print (default 10)\n"
+           "  --components           enumerate every placement of the starting pieces and\n"
+           "                         report the connected components of the moves graph\n"
+           "  --components-count N   number of largest components to print (default 10)\n"
+           "  --sheet-frames N       split the solution into SVG sheets of N frames each,\n"
+           "                         written to klotski_solution_001.svg, ...\n"
+           "  --animated             write klotski_solution.svg as a single animated grid,\n"
+           "                         not combined with --sheet-frames\n"
+           "  --statistics           print counters of the moves tried while solving, and\n"
+           "                         the memory held by the solver\n"
+           "  --compress-levels      with the bitboard engine, keep the visited keys of the\n"
+           "                         last two levels only, sorted and delta-coded\n"
+           "  --progress             print the progress of the search to stderr at the end\n"
+           "                         of each level\n"
+           "  --pipelined            with the bitboard engine, generate children on a thread\n"
+           "                         of its own, and insert them in the visited set by\n"
+           "                         batches partitioned on the table slots\n"
+           "  --memory-timeline FILE write the bytes held by the solver at the end of each\n"
+           "                         search level to FILE, as comma-separated values\n"
+           "  --binary FILE          also append the solution to FILE as a packed binary record\n"
+           "  --read-binary FILE     print the solutions of the starting grid packed in FILE\n"
+           "  --daemon PATH          serve solve requests on a Unix domain socket, one\n"
+           "                         grid per line (e.g. \"A10 B00 B30 ... D34\"), answered\n"
+           "                         with \"ok N MOVES...\" or \"error MESSAGE\"\n"
+           "  --cache-bytes N        memory cap of the daemon solutions cache (default 64 MiB)\n"
+           "  --goal S:X,Y           solve for any piece of symbol S at position X,Y,\n"
+           "                         repeatable, all goals sharing one search tree\n"
+           "  --check-threads N      solve N grids reachable from the starting grid with one\n"
+           "                         thread and with --threads threads, and check that\n"
+           "                         solutions are identical, and match the reference engine\n"
+           "  --generate N           print N random placements of the starting pieces whose\n"
+           "                         optimal solution is within the moves range, one per\n"
+           "                         line as a grid (e.g. \"A10 B00 ... D34\") and a count\n"
+           "  --differential N       solve N random placements of the starting pieces with\n"
+           "                         every engine, check that move counts match those of a\n"
+           "                         plain breadth-first search and that paths replay to\n"
+           "                         the solved grid, and report the time taken by each engine\n"
+           "  --benchmark-visited N  insert N keys, half of them duplicates, into the lock-free\n"
+           "                         visited set and into a visited set behind a mutex, from\n"
+           "                         1 to 64 threads, and report the throughput\n"
+           "  --check-visited N      insert N keys twice into a lock-free visited set from\n"
+           "                         --threads threads, shards growing many times meanwhile,\n"
+           "                         and check that each key is found new once and kept\n"
+           "  --min-moves N          shortest optimal solution to generate (default 1)\n"
+           "  --max-moves N          longest optimal solution to generate (default none)\n"
+           "  --seed N               seed of random placements (default 1)\n"
+           "  --threads N            number of worker threads (default: all cores)\n";
+}
+
+KlotskiSolution solveWith(Options::Engine engine, KlotskiGrid const& grid, BitboardSettings const& settings = {})
+{
+    switch (engine) {
+    case Options::Reference:
+        return solvePuzzle(grid, isSolved, KlotskiGrid::HorizontalSymmetry, settings.progress);
+    case Options::Bitboard:
+        return solvePuzzleBitboard(grid, solvedGoals(grid), KlotskiGrid::HorizontalSymmetry, settings);
+    }
+    throw std::runtime_error("unknown engine");
+}
+
+void printPath(std::ostream& out, KlotskiGrid const& startingGrid, std::vector<Move> const& path)
+{
+    out << "list of moves (" << path.size() << "):\n";
+    for (auto const& move : path) {
+        auto const& piece = startingGrid.pieces[move.pieceIndex];
+        out << piece.name() << move.step.toString() << " ";
+    }
+    out << "\n";
+}
+
+void printStatistics(std::ostream& out, ExpansionStatistics const& statistics)
+{
+    auto const percentOfTried = [&](size_t count) {
+        return statistics.triedCount == 0 ? 0.0 : 100.0 * count / statistics.triedCount;
+    };
+    out << "moves tried: " << statistics.triedCount << "\n";
+    out << std::format("  pruned as undoing the last move: {} ({:.1f}%)\n",
+        statistics.prunedCount, percentOfTried(statistics.prunedCount));
+    out << std::format("  invalid: {} ({:.1f}%)\n",
+        statistics.invalidCount, percentOfTried(statistics.invalidCount));
+    out << std::format("  reaching a visited grid: {} ({:.1f}%)\n",
+        statistics.duplicateCount, percentOfTried(statistics.duplicateCount));
+    out << std::format("  reaching a new grid: {} ({:.1f}%)\n",
+        statistics.appendedCount, percentOfTried(statistics.appendedCount));
+}
+
+void printProgress(SearchProgress const& progress)
+{
+    std::cerr << std::format(
+        "depth {}: {} states in frontier, {} visited, {:.0f} states/s, {:.1f} MiB, "
+        "next level ~{:.0f} states in ~{:.2f} s\n",
+        progress.depth, progress.frontierCount, progress.visitedCount, progress.statesPerSecond,
+        double(progress.memoryBytes) / (1 << 20),
+        progress.estimatedNextCount, progress.estimatedNextSeconds);
+}
+
+void printMemory(std::ostream& out, KlotskiSolution const& solution)
+{
+    auto const& timeline = solution.memoryTimeline;
+    auto const largest = std::max_element(timeline.begin(), timeline.end(),
+        [](MemoryUsage const& lhs, MemoryUsage const& rhs) {
+            return lhs.totalBytes() < rhs.totalBytes();
+        });
+    if (largest == timeline.end())
+        return;
+
+    out << "peak memory: " << solution.peakMemoryBytes << " bytes\n";
+    out << "largest level, at depth " << largest - timeline.begin() << ":\n";
+    out << "  keys: " << largest->keysBytes << " bytes\n";
+    out << "  edges: " << largest->edgesBytes << " bytes\n";
+    out << "  nodes: " << largest->nodesBytes << " bytes\n";
+    out << "  levels: " << largest->levelsBytes << " bytes\n";
+}
+
+void writeMemoryTimeline(std::ostream& out, std::vector<MemoryUsage> const& timeline)
+{
+    out << "depth,keys,edges,nodes,levels,total\n";
+    for (size_t depth = 0; depth < timeline.size(); ++depth) {
+        auto const& usage = timeline[depth];
+        out << std::format("{},{},{},{},{},{}\n", depth,
+            usage.keysBytes, usage.edgesBytes, usage.nodesBytes, usage.levelsBytes,
+            usage.totalBytes());
+    }
+}
 
+int runSolve(KlotskiGrid const& startingGrid, Options const& options)
+{
     std::cout << "initial grid:" << startingGrid << "\n";
 
-    try {
-        KlotskiSolution solution = solvePuzzle(
-            startingGrid,
-            [](KlotskiGrid const& grid) {
-                for (auto const& piece : grid.pieces)
-                    if (piece.tag == PieceTag{'A', 1})
-                        return piece.position == Vect2{1, 3};
-                return false;
-            },
-            KlotskiGrid::HorizontalSymmetry);
+    BitboardSettings settings = {options.threadsCount, options.compressedLevels, options.pipelined, {}};
+    if (options.progress)
+        settings.progress = printProgress;
+    KlotskiSolution const solution = solveWith(options.engine, startingGrid, settings);
 
-        std::cout << "solved grid:" << solution.grid << "\n";
-        std::cout << "list of moves (" << solution.path.size() << "):\n";
-        for (auto const& move : solution.path) {
-            auto const& piece = startingGrid.pieces[move.pieceIndex];
-            std::cout << piece.name() << move.step.toString() << " ";
+    std::cout << "solved grid:" << solution.grid << "\n";
+    printPath(std::cout, startingGrid, solution.path);
+    if (options.statistics) {
+        printStatistics(std::cout, solution.statistics);
+        printMemory(std::cout, solution);
+    }
+
+    if (!options.memoryTimelineFilename.empty()) {
+        std::ofstream timelineFile(options.memoryTimelineFilename);
+        if (!timelineFile.is_open()) {
+            std::cerr << "could not open memory timeline file in write mode\n";
+            return 1;
         }
-        std::cout << "\n";
+        writeMemoryTimeline(timelineFile, solution.memoryTimeline);
+    }
 
-        auto const filename = "klotski_solution.svg";
-        std::ofstream svgFile(filename, std::ios::out | std::ios::binary);
-        if (!svgFile.is_open()) {
-            std::cerr << "could not open svg file in write mode\n";
+    if (!options.binaryFilename.empty()) {
+        // records are appended, so that a file collects several solutions
+        std::ofstream binaryFile(options.binaryFilename, std::ios::out | std::ios::binary | std::ios::app);
+        if (!binaryFile.is_open()) {
+            std::cerr << "could not open binary file in write mode\n";
             return 1;
         }
+        writeSolution(binaryFile, startingGrid, solution.path);
+    }
+
+    if (options.sheetFrames > 0) {
+        KlotskiSVGRenderer{}.renderSheets(
+            startingGrid, solution.path, options.sheetFrames, options.threadsCount,
+            [](size_t sheetIndex) {
+                auto const filename = std::format("klotski_solution_{:03}.svg", sheetIndex + 1);
+                auto svgFile = std::make_unique<std::ofstream>(
+                    filename, std::ios::out | std::ios::binary);
+                if (!svgFile->is_open())
+                    throw std::runtime_error("could not open svg file in write mode");
+                return svgFile;
+            });
+        return 0;
+    }
+
+    auto const filename = "klotski_solution.svg";
+    std::ofstream svgFile(filename, std::ios::out | std::ios::binary);
+    if (!svgFile.is_open()) {
+        std::cerr << "could not open svg file in write mode\n";
+        return 1;
+    }
+    if (options.animated)
+        KlotskiSVGRenderer{}.renderAnimation(svgFile, startingGrid, solution.path);
+    else
         KlotskiSVGRenderer{}.renderGrids(svgFile, startingGrid, solution.path);
-        svgFile.close();
+    svgFile.close();
+    return 0;
+}
+
+int runHardest(KlotskiGrid const& startingGrid, Options const& options)
+{
+    using KlotskiStateGraph = StateGraph<KlotskiGrid>;
+
+    auto const graph = KlotskiStateGraph::explore(
+        {startingGrid}, KlotskiGrid::HorizontalSymmetry);
+    auto const distances = graph.distancesTo(isSolved);
+    auto const report = makeDifficultyReport(distances, KlotskiStateGraph::unreachable);
+
+    std::cout << "reachable configurations: " << report.statesCount << "\n";
+    std::cout << "unsolvable configurations: " << report.unsolvableCount << "\n";
+    if (report.hardestStates.empty())
         return 0;
+
+    std::cout << "distribution of optimal move counts:\n";
+    for (auto const& [distance, count] : report.distribution)
+        std::cout << std::format("  {:4} moves: {}\n", distance, count);
+
+    std::cout << "hardest positions (" << report.hardestStates.size()
+              << ", " << report.maxDistance << " moves):\n";
+    for (size_t index = 0; index < report.hardestStates.size(); ++index) {
+        if (index >= options.hardestCount) {
+            std::cout << "... and " << report.hardestStates.size() - index << " more\n";
+            break;
+        }
+        std::cout << "position " << index + 1 << ":"
+                  << graph.states[report.hardestStates[index]] << "\n";
+    }
+    return 0;
+}
+
+int runComponents(KlotskiGrid const& startingGrid, Options const& options)
+{
+    using KlotskiStateGraph = StateGraph<KlotskiGrid>;
+
+    auto const placements = enumeratePlacements(startingGrid);
+    ComponentIndex<KlotskiGrid> const index(
+        KlotskiStateGraph::explore(placements, KlotskiGrid::HorizontalSymmetry), isSolved);
+
+    size_t solvableCount = 0;
+    size_t solvableStatesCount = 0;
+    std::vector<size_t> components(index.componentsCount());
+    for (size_t label = 0; label < components.size(); ++label) {
+        components[label] = label;
+        if (index.solvable[label]) {
+            solvableCount += 1;
+            solvableStatesCount += index.sizes[label];
+        }
+    }
+    std::stable_sort(components.begin(), components.end(), [&](size_t lhs, size_t rhs) {
+        return index.sizes[lhs] > index.sizes[rhs];
+    });
+
+    std::cout << "valid configurations: " << index.graph.size() << "\n";
+    std::cout << "connected components: " << index.componentsCount()
+              << " (" << solvableCount << " solvable, "
+              << solvableStatesCount << " solvable configurations)\n";
+
+    std::cout << "largest components:\n";
+    for (size_t rank = 0; rank < components.size() && rank < options.componentsCount; ++rank) {
+        size_t const label = components[rank];
+        std::cout << std::format("  #{:<6} {:8} configurations, {}\n",
+            label, index.sizes[label], index.solvable[label] ? "solvable" : "unsolvable");
+    }
+
+    std::cout << "starting grid is in component #" << index.componentOf(startingGrid)
+              << ", " << (index.isSolvable(startingGrid) ? "solvable" : "unsolvable") << "\n";
+    return 0;
+}
+
+int runGoals(KlotskiGrid const& startingGrid, Options const& options)
+{
+    // goals are not expected to be symmetric, keep mirrored states apart
+    ResumableSolver solver(startingGrid, KlotskiGrid::NoSymmetry);
+
+    for (auto const& [symbol, position] : options.goals) {
+        std::cout << std::format("goal {}:{},{}: ", symbol, position.x, position.y);
+        try {
+            auto const solution = solver.solve([&](KlotskiGrid const& grid) {
+                for (auto const& piece : grid.pieces)
+                    if (piece.tag.symbol == symbol && piece.position == position)
+                        return true;
+                return false;
+            });
+            printPath(std::cout, startingGrid, solution.path);
+        }
+        catch (std::runtime_error const& e) {
+            std::cout << e.what() << "\n";
+        }
+    }
+    return 0;
+}
+
+int runReadBinary(KlotskiGrid const& startingGrid, Options const& options)
+{
+    std::ifstream binaryFile(options.binaryFilename, std::ios::in | std::ios::binary);
+    if (!binaryFile.is_open()) {
+        std::cerr << "could not open binary file in read mode\n";
+        return 1;
+    }
+
+    while (auto const path = readSolution(binaryFile, startingGrid)) {
+        KlotskiGrid grid = startingGrid;
+        for (auto const& move : *path) {
+            grid.apply(move);
+            if (!grid.validate())
+                throw std::runtime_error("packed solution contains an invalid move");
+        }
+        if (!isSolved(grid))
+            throw std::runtime_error("packed solution does not solve the grid");
+
+        printPath(std::cout, startingGrid, *path);
+    }
+    return 0;
+}
+
+// Solutions are cached by canonical key, so a grid and its mirror image
+// share their entry.  Moves are stored in the orientation of the canonical
+// key, each one designating its piece by one of the cells it covers, which
+// translates back to the piece indices of any grid sharing that key.
+struct CachedMove
+{
+    Vect2 cell;
+    Step step;
+};
+
+using SolutionsCache = LruCache<std::string, std::vector<CachedMove>>;
+
+std::vector<CachedMove> toCachedPath(
+    KlotskiGrid grid, std::vector<Move> const& path, bool mirrored)
+{
+    std::vector<CachedMove> cachedPath;
+    cachedPath.reserve(path.size());
+    for (auto const& move : path) {
+        auto const& piece = grid.pieces[move.pieceIndex];
+        Vect2 cell = piece.position + *piece.geom.begin();
+        Step step = move.step;
+        if (mirrored) {
+            cell.x = KlotskiGrid::sizeX - 1 - cell.x;
+            step.vector.x = -step.vector.x;
+        }
+        cachedPath.push_back({cell, step});
+        grid.apply(move);
+    }
+    return cachedPath;
+}
+
+std::vector<Move> fromCachedPath(
+    KlotskiGrid grid, std::vector<CachedMove> const& cachedPath, bool mirrored)
+{
+    std::vector<Move> path;
+    path.reserve(cachedPath.size());
+    for (auto cachedMove : cachedPath) {
+        if (mirrored) {
+            cachedMove.cell.x = KlotskiGrid::sizeX - 1 - cachedMove.cell.x;
+            cachedMove.step.vector.x = -cachedMove.step.vector.x;
+        }
+        auto const validated = grid.validate();
+        if (!validated)
+            throw std::runtime_error("cached solution replays into an invalid grid");
+
+        PieceTag const tag = (*validated)[cachedMove.cell];
+        auto const piece = std::find_if(grid.pieces.begin(), grid.pieces.end(),
+            [&](Piece const& piece) { return piece.tag == tag; });
+        if (piece == grid.pieces.end())
+            throw std::runtime_error("cached solution moves an empty cell");
+
+        Move const move = {size_t(piece - grid.pieces.begin()), cachedMove.step};
+        path.push_back(move);
+        grid.apply(move);
+    }
+    return path;
+}
+
+int runCheckThreads(KlotskiGrid const& startingGrid, Options const& options)
+{
+    auto const graph = StateGraph<KlotskiGrid>::explore(
+        {startingGrid}, KlotskiGrid::HorizontalSymmetry);
+
+    auto const samePath = [](std::vector<Move> const& lhs, std::vector<Move> const& rhs) {
+        return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+            [](Move const& a, Move const& b) {
+                return a.pieceIndex == b.pieceIndex && a.step.vector == b.step.vector;
+            });
+    };
+
+    // grids are picked evenly among reachable ones, solved ones included
+    size_t const checkedCount = std::min(options.checkedCount, graph.size());
+    size_t const threadsCount = std::max<size_t>(options.threadsCount, 2);
+    size_t mismatchesCount = 0;
+
+    for (size_t index = 0; index < checkedCount; ++index) {
+        auto const& grid = graph.states[index * graph.size() / checkedCount];
+        auto const reference = solveWith(Options::Reference, grid);
+        auto const serial = solveWith(Options::Bitboard, grid, {1});
+        auto const parallel = solveWith(Options::Bitboard, grid, {threadsCount});
+
+        if (samePath(serial.path, parallel.path) && samePath(serial.path, reference.path))
+            continue;
+
+        mismatchesCount += 1;
+        std::cout << "mismatch for grid " << formatGrid(grid) << "\n";
+        std::cout << "reference ";
+        printPath(std::cout, grid, reference.path);
+        std::cout << "1 thread ";
+        printPath(std::cout, grid, serial.path);
+        std::cout << threadsCount << " threads ";
+        printPath(std::cout, grid, parallel.path);
+    }
+
+    std::cout << std::format("{} grids checked with 1 and {} threads, {} mismatches\n",
+        checkedCount, threadsCount, mismatchesCount);
+    return mismatchesCount == 0 ? 0 : 1;
+}
+
+// Tells what is wrong with a path solving a grid, if anything.
+std::optional<std::string> checkPath(KlotskiGrid grid, std::vector<Move> const& path)
+{
+    for (size_t moveIndex = 0; moveIndex < path.size(); ++moveIndex) {
+        if (path[moveIndex].pieceIndex >= grid.pieces.size())
+            return std::format("move {} has an out of bounds piece index", moveIndex + 1);
+        grid.apply(path[moveIndex]);
+        if (!grid.validate())
+            return std::format("move {} leads to an invalid grid", moveIndex + 1);
+    }
+    if (!isSolved(grid))
+        return "path does not reach a solved grid";
+    return std::nullopt;
+}
+
+// Plain breadth-first search keyed by Cells::key(), without the pruning,
+// hashing or bitboards of the engines, used as their oracle.  Gives the
+// optimal moves count of a grid, or nothing if it cannot be solved.
+std::optional<size_t> optimalMovesCount(KlotskiGrid const& initialGrid)
+{
+    auto const validated = initialGrid.validate();
+    if (!validated)
+        throw std::runtime_error("initial grid is invalid");
+
+    std::unordered_set<std::string> visited = {validated->key(KlotskiGrid::HorizontalSymmetry)};
+    std::vector<KlotskiGrid> level = {initialGrid};
+
+    for (size_t depth = 0; !level.empty(); ++depth) {
+        std::vector<KlotskiGrid> nextLevel;
+        for (auto const& parent : level) {
+            if (isSolved(parent))
+                return depth;
+
+            for (size_t const pieceIndex : IndexRange{0, parent.pieces.size()})
+            for (auto const& step : Step::all()) {
+                KlotskiGrid grid = parent;
+                grid.apply({pieceIndex, step});
+
+                auto const validated = grid.validate();
+                if (validated && visited.insert(validated->key(KlotskiGrid::HorizontalSymmetry)).second)
+                    nextLevel.push_back(std::move(grid));
+            }
+        }
+        level = std::move(nextLevel);
+    }
+    return std::nullopt;
+}
+
+int runDifferential(KlotskiGrid const& startingGrid, Options const& options)
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Engine {
+        std::string_view name;
+        std::function<KlotskiSolution (KlotskiGrid const&)> solve;
+        Clock::duration duration;
+    };
+
+    size_t const threadsCount = std::max<size_t>(options.threadsCount, 2);
+    std::vector<Engine> engines = {
+        {"reference", [](KlotskiGrid const& grid) {
+            return solveWith(Options::Reference, grid);
+        }, {}},
+        {"bitboard", [](KlotskiGrid const& grid) {
+            return solveWith(Options::Bitboard, grid, {1});
+        }, {}},
+        {"bitboard parallel", [&](KlotskiGrid const& grid) {
+            return solveWith(Options::Bitboard, grid, {threadsCount});
+        }, {}},
+        {"bitboard compressed", [](KlotskiGrid const& grid) {
+            return solveWith(Options::Bitboard, grid, {1, true});
+        }, {}},
+        {"bitboard pipelined", [&](KlotskiGrid const& grid) {
+            return solveWith(Options::Bitboard, grid, {threadsCount, false, true});
+        }, {}},
+        {"resumable", [](KlotskiGrid const& grid) {
+            return ResumableSolver(grid, KlotskiGrid::HorizontalSymmetry).solve(isSolved);
+        }, {}},
+    };
+
+    std::mt19937_64 random(options.seed);
+    size_t solvableCount = 0;
+    size_t failuresCount = 0;
+
+    for (size_t index = 0; index < options.differentialCount; ++index) {
+        KlotskiGrid const grid = randomPlacement(startingGrid, random);
+
+        std::optional<size_t> const oracleCount = optimalMovesCount(grid);
+        for (auto& engine : engines) {
+            std::optional<KlotskiSolution> solution;
+            std::optional<std::string> failure;
+            auto const start = Clock::now();
+            try {
+                solution = engine.solve(grid);
+            }
+            catch (UnsolvableError const&) {}
+            catch (std::exception const& e) {
+                failure = std::format("error: {}", e.what());
+            }
+            engine.duration += Clock::now() - start;
+
+            std::optional<size_t> const movesCount =
+                solution ? std::optional(solution->path.size()) : std::nullopt;
+            if (!failure && movesCount != oracleCount)
+                failure = std::format("found {} moves, oracle found {}",
+                    movesCount ? std::to_string(*movesCount) : "no solution",
+                    oracleCount ? std::to_string(*oracleCount) : "no solution");
+            else if (!failure && solution)
+                failure = checkPath(grid, solution->path);
+
+            if (failure) {
+                failuresCount += 1;
+                std::cout << std::format("{} failed on {}: {}\n", engine.name, formatGrid(grid), *failure);
+            }
+        }
+        if (oracleCount)
+            solvableCount += 1;
+    }
+
+    std::cout << std::format("{} grids checked, {} solvable, {} failures\n",
+        options.differentialCount, solvableCount, failuresCount);
+    for (auto const& engine : engines) {
+        auto const milliseconds = std::chrono::duration<double, std::milli>(engine.duration).count();
+        std::cout << std::format("  {:<20} {:10.1f} ms\n", engine.name, milliseconds);
+    }
+    return failuresCount == 0 ? 0 : 1;
+}
+
+struct KeyMixer
+{
+    size_t operator()(uint64_t key) const {
+        key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9;
+        key = (key ^ (key >> 27)) * 0x94d049bb133111eb;
+        return size_t(key ^ (key >> 31));
+    }
+};
+
+// key of a visited set benchmark or check, never 0 nor ~0
+uint64_t visitedKeyAt(size_t index)
+{
+    return (KeyMixer{}(index) >> 1) | 1;
+}
+
+int runBenchmarkVisited(Options const& options)
+{
+    using Clock = std::chrono::steady_clock;
+
+    // each distinct key is inserted twice, the second time by another thread
+    // most of the time
+    size_t const insertionsCount = options.benchmarkedCount;
+    size_t const distinctCount = (insertionsCount + 1) / 2;
+    auto const keyAt = [&](size_t insertion) {
+        return visitedKeyAt(insertion % distinctCount);
+    };
+
+    auto const run = [&](size_t threadsCount, auto const& insert) {
+        std::atomic<size_t> insertedCount = 0;
+        auto const start = Clock::now();
+
+        std::vector<std::thread> workers;
+        for (size_t thread = 0; thread < threadsCount; ++thread)
+            workers.emplace_back([&, thread]() {
+                size_t inserted = 0;
+                for (size_t insertion = thread; insertion < insertionsCount; insertion += threadsCount)
+                    inserted += insert(keyAt(insertion));
+                insertedCount += inserted;
+            });
+        for (auto& worker : workers)
+            worker.join();
+
+        double const seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (insertedCount != distinctCount)
+            throw std::runtime_error(std::format("{} keys found new, expected {}",
+                insertedCount.load(), distinctCount));
+        return insertionsCount / seconds / 1e6;
+    };
+
+    std::cout << std::format("{} insertions of {} distinct keys, in millions of insertions per second\n",
+        insertionsCount, distinctCount);
+    std::cout << "threads   lock-free   mutex\n";
+    for (size_t threadsCount = 1; threadsCount <= 64; threadsCount *= 2) {
+        ConcurrentVisitedSet<KeyMixer> concurrentSet;
+        double const lockFree = run(threadsCount, [&](uint64_t key) {
+            return concurrentSet.insert(key);
+        });
+
+        VisitedSet<uint64_t, KeyMixer> lockedSet;
+        std::mutex mutex;
+        double const locked = run(threadsCount, [&](uint64_t key) {
+            size_t const hash = KeyMixer{}(key);
+            std::lock_guard lock(mutex);
+            return lockedSet.insert(key, hash);
+        });
+
+        std::cout << std::format("{:7} {:11.2f} {:7.2f}\n", threadsCount, lockFree, locked);
+    }
+    return 0;
+}
+
+// Shards start with a few slots, so that they grow many times while threads
+// insert into them, each key being inserted twice.  Every key must be found
+// new exactly once, found again afterwards, and counted once by size().
+int runCheckVisited(Options const& options)
+{
+    size_t const threadsCount = std::max<size_t>(options.threadsCount, 2);
+    size_t const keysCount = options.checkedKeysCount;
+    int const shardBits = 1;
+    size_t const shardCapacity = 16;
+    size_t const initialCapacity = (size_t(1) << shardBits) * shardCapacity;
+    ConcurrentVisitedSet<KeyMixer> visitedSet(shardBits, shardCapacity);
+    std::atomic<size_t> insertedCount = 0;
+
+    std::vector<std::thread> workers;
+    for (size_t thread = 0; thread < threadsCount; ++thread)
+        workers.emplace_back([&, thread]() {
+            size_t inserted = 0;
+            for (size_t insertion = thread; insertion < 2 * keysCount; insertion += threadsCount)
+                inserted += visitedSet.insert(visitedKeyAt(insertion % keysCount));
+            insertedCount += inserted;
+        });
+    for (auto& worker : workers)
+        worker.join();
+
+    size_t lostCount = 0;
+    for (size_t index = 0; index < keysCount; ++index)
+        lostCount += visitedSet.insert(visitedKeyAt(index));
+
+    size_t const duplicatedCount = insertedCount > keysCount ? insertedCount - keysCount : 0;
+    size_t const size = visitedSet.size();
+    std::cout << std::format("{} keys inserted twice by {} threads, shards grown from {} to {} slots, "
+        "{} found new, {} duplicated, {} lost, {} held\n",
+        keysCount, threadsCount, initialCapacity, visitedSet.capacity(),
+        insertedCount.load(), duplicatedCount, lostCount, size);
+    return duplicatedCount == 0 && lostCount == 0 && insertedCount == keysCount && size == keysCount ? 0 : 1;
+}
+
+// Each worker draws candidates numbered in increasing order, the candidate
+// of a number always being the same placement, and solves them.  Accepted
+// puzzles are printed by candidate number once enough distinct ones are
+// found, so that the output does not depend on the number of threads.
+int runGenerate(KlotskiGrid const& startingGrid, Options const& options)
+{
+    if (options.minMoves > options.maxMoves)
+        throw std::runtime_error("empty range of moves");
+
+    struct Puzzle {
+        size_t candidateIndex;
+        KlotskiGrid grid;
+        size_t movesCount;
+    };
+
+    size_t const maxCandidates = std::max<size_t>(options.generatedCount, 1) * 100000;
+    std::atomic<size_t> nextCandidate = 0;
+    std::mutex mutex;
+    std::vector<Puzzle> puzzles;
+    std::unordered_set<std::string> keys;
+    std::exception_ptr error;
+
+    auto const worker = [&]() {
+        for (size_t candidateIndex = nextCandidate++;
+                    candidateIndex < maxCandidates;
+                    candidateIndex = nextCandidate++) {
+            try {
+                // the seed of a candidate depends on its number only, not
+                // on how many candidates may be drawn
+                std::mt19937_64 random(KeyMixer{}(KeyMixer{}(options.seed) + candidateIndex));
+                KlotskiGrid const grid = randomPlacement(startingGrid, random);
+
+                size_t movesCount;
+                try {
+                    movesCount = solveWith(options.engine, grid).path.size();
+                }
+                catch (UnsolvableError const&) {
+                    continue;
+                }
+                if (movesCount < options.minMoves || movesCount > options.maxMoves)
+                    continue;
+
+                std::lock_guard lock(mutex);
+                puzzles.push_back({candidateIndex, grid, movesCount});
+                keys.insert(grid.validate()->key(KlotskiGrid::HorizontalSymmetry));
+                if (keys.size() >= options.generatedCount)
+                    nextCandidate = maxCandidates;
+            }
+            catch (...) {
+                std::lock_guard lock(mutex);
+                if (!error)
+                    error = std::current_exception();
+                nextCandidate = maxCandidates;
+            }
+        }
+    };
+
+    WorkerPool(options.threadsCount).run(worker, options.threadsCount);
+    if (error)
+        std::rethrow_exception(error);
+
+    std::sort(puzzles.begin(), puzzles.end(), [](Puzzle const& lhs, Puzzle const& rhs) {
+        return lhs.candidateIndex < rhs.candidateIndex;
+    });
+
+    keys.clear();
+    size_t printedCount = 0;
+    for (auto const& puzzle : puzzles) {
+        if (printedCount == options.generatedCount)
+            break;
+        if (!keys.insert(puzzle.grid.validate()->key(KlotskiGrid::HorizontalSymmetry)).second)
+            continue;
+        std::cout << formatGrid(puzzle.grid) << " " << puzzle.movesCount << "\n";
+        printedCount += 1;
+    }
+
+    if (printedCount < options.generatedCount) {
+        std::cerr << "only " << printedCount << " puzzles found in "
+                  << maxCandidates << " candidates\n";
+        return 1;
+    }
+    return 0;
+}
+
+std::string handleRequest(
+    SolutionsCache& cache, Options::Engine engine, std::string_view request)
+{
+    if (request == "stats") {
+        auto const statistics = cache.getStatistics();
+        return std::format("ok entries={} bytes={} hits={} misses={} evictions={}",
+            statistics.entriesCount, statistics.bytesCount,
+            statistics.hitsCount, statistics.missesCount, statistics.evictionsCount);
+    }
+
+    KlotskiGrid const grid = parseGrid(request);
+    auto const validated = grid.validate();
+    auto const key = validated->key(KlotskiGrid::HorizontalSymmetry);
+    bool const mirrored = validated->key(KlotskiGrid::NoSymmetry) != key;
+
+    auto cachedPath = cache.find(key);
+    if (!cachedPath) {
+        auto const solution = solveWith(engine, grid);
+        cachedPath = toCachedPath(grid, solution.path, mirrored);
+        cache.insert(key, *cachedPath);
+    }
+
+    auto const path = fromCachedPath(grid, *cachedPath, mirrored);
+    std::string response = std::format("ok {}", path.size());
+    for (auto const& move : path) {
+        response.push_back(' ');
+        response += grid.pieces[move.pieceIndex].name();
+        response += move.step.toString();
+    }
+    return response;
+}
+
+int runDaemon(Options const& options)
+{
+#if defined(SOLVER_DAEMON_SUPPORTED)
+    SolutionsCache cache(options.cacheBytes,
+        [](std::string const& key, std::vector<CachedMove> const& path) {
+            // entry, list node and index node bookkeeping are estimated
+            return sizeof(key) + key.capacity()
+                 + sizeof(path) + path.capacity() * sizeof(CachedMove)
+                 + 8 * sizeof(void*);
+        });
+
+    SocketServer server(options.socketPath, options.threadsCount,
+        [&](std::string_view request) {
+            return handleRequest(cache, options.engine, request);
+        });
+
+    std::cerr << "listening on " << options.socketPath << "\n";
+    server.run();
+#else
+    (void)options;
+    throw std::runtime_error("the daemon needs Unix domain sockets, not available on this platform");
+#endif
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    try {
+        options = parseOptions({argv + 1, argv + argc});
+    }
+    catch (std::exception const& e) {
+        std::cerr << "ERROR: " << e.what() << "\n";
+        printUsage(std::cerr);
+        return 2;
+    }
+
+    try {
+        KlotskiGrid const startingGrid = makeStartingGrid();
+
+        switch (options.mode) {
+        case Options::Solve:
+            return runSolve(startingGrid, options);
+        case Options::Hardest:
+            return runHardest(startingGrid, options);
+        case Options::Components:
+            return runComponents(startingGrid, options);
+        case Options::ReadBinary:
+            return runReadBinary(startingGrid, options);
+        case Options::Goals:
+            return runGoals(startingGrid, options);
+        case Options::Daemon:
+            return runDaemon(options);
+        case Options::CheckThreads:
+            return runCheckThreads(startingGrid, options);
+        case Options::Generate:
+            return runGenerate(startingGrid, options);
+        case Options::Differential:
+            return runDifferential(startingGrid, options);
+        case Options::BenchmarkVisited:
+            return runBenchmarkVisited(options);
+        case Options::CheckVisited:
+            return runCheckVisited(options);
+        }
+        return 1;
     }
     catch (std::exception const& e) {
         std::cerr << "ERROR: " << e.what() << "\n";
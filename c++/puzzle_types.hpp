@@ -4,14 +4,19 @@
 #ifndef PUZZLE_TYPES_HPP_INCLUDED
 #define PUZZLE_TYPES_HPP_INCLUDED
 
+#include <algorithm>
 #include <array>
+#include <chrono>
 #include <deque>
 #include <format>
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <optional>
 #include <stdexcept>
 #include <string>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
 
@@ -103,6 +108,15 @@ struct Step
         return {up(), down(), left(), right()};
     }
 
+    // position of the step in all(), or -1 if it is not a unit step
+    constexpr int index() const {
+        auto const steps = all();
+        for (size_t index = 0; index < steps.size(); ++index)
+            if (steps[index].vector == vector)
+                return int(index);
+        return -1;
+    }
+
     std::string toString() const {
         if (vector == Vect2{0, 0})
             return "•";
@@ -128,6 +142,38 @@ struct Move
 {
     size_t pieceIndex;
     Step step;
+
+    // tells whether this move brings back the grid the other one started from
+    bool undoes(Move const& other) const {
+        return pieceIndex == other.pieceIndex && step.vector + other.step.vector == Vect2{0, 0};
+    }
+};
+
+// Counters of the moves tried while expanding a search tree.  Moves undoing
+// the one that led to their parent always reach a visited grid, and are
+// pruned before the grid is copied and validated.
+struct ExpansionStatistics
+{
+    size_t triedCount;
+    size_t prunedCount;
+    size_t invalidCount;
+    size_t duplicateCount;
+    size_t appendedCount;
+};
+
+// a piece expected at a given position, goals being lists of them
+struct PieceGoal
+{
+    size_t pieceIndex;
+    Vect2 position;
+};
+
+// Thrown by a search having visited every state reachable from its initial
+// one without meeting its goal, as opposed to failing.
+struct UnsolvableError : std::runtime_error
+{
+    UnsolvableError()
+    : std::runtime_error("reached end of tree, no more solutions to explore") {}
 };
 
 
@@ -236,6 +282,14 @@ private:
     }
 };
 
+template<typename Grid>
+bool reached(Grid const& grid, std::vector<PieceGoal> const& goals) {
+    for (auto const& goal : goals)
+        if (grid.pieces.at(goal.pieceIndex).position != goal.position)
+            return false;
+    return true;
+}
+
 template<int SizeX, int SizeY>
 inline std::ostream&
 operator<<(std::ostream& out, Grid<SizeX, SizeY> const& grid) {
@@ -283,9 +337,155 @@ struct IndexRange {
 };
 
 
+// State of a search once a level is complete.  The next level is estimated
+// to grow from this one as this one grew from the previous one.
+struct SearchProgress
+{
+    size_t depth;
+    size_t frontierCount;
+    size_t visitedCount;
+    size_t memoryBytes;
+    double elapsedSeconds;
+    double statesPerSecond;
+    double estimatedNextCount;
+    double estimatedNextSeconds;
+};
+
+using ProgressCallback = std::function<void (SearchProgress const&)>;
+
+// Reports the progress of a search to a callback, if any, the time being
+// measured from the construction of the meter.
+struct ProgressMeter
+{
+    using Clock = std::chrono::steady_clock;
+
+    explicit ProgressMeter(ProgressCallback callback)
+    : callback(std::move(callback)), start(this->callback ? Clock::now() : Clock::time_point()) {}
+
+    void levelReached(size_t depth, size_t frontierCount, size_t visitedCount, size_t memoryBytes) {
+        if (!callback)
+            return;
+
+        SearchProgress progress = {};
+        progress.depth = depth;
+        progress.frontierCount = frontierCount;
+        progress.visitedCount = visitedCount;
+        progress.memoryBytes = memoryBytes;
+        progress.elapsedSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+        progress.statesPerSecond = progress.elapsedSeconds > 0
+            ? double(visitedCount) / progress.elapsedSeconds : 0.0;
+        progress.estimatedNextCount = previousFrontierCount > 0
+            ? double(frontierCount) * double(frontierCount) / double(previousFrontierCount)
+            : double(frontierCount);
+        progress.estimatedNextSeconds = progress.statesPerSecond > 0
+            ? progress.estimatedNextCount / progress.statesPerSecond : 0.0;
+
+        previousFrontierCount = frontierCount;
+        callback(progress);
+    }
+
+private:
+    ProgressCallback const callback;
+    Clock::time_point const start;
+    size_t previousFrontierCount = 0;
+};
+
+// Bytes held by the structures of a search: keys of visited states, edges
+// to parents, states of the frontier, and bookkeeping of levels along with
+// any scratch buffer.
+struct MemoryUsage
+{
+    size_t keysBytes;
+    size_t edgesBytes;
+    size_t nodesBytes;
+    size_t levelsBytes;
+
+    size_t totalBytes() const {
+        return keysBytes + edgesBytes + nodesBytes + levelsBytes;
+    }
+};
+
+// Bytes held by a structure, and peak of the bytes held by all of them.
+struct MemoryCounters
+{
+    MemoryUsage usage;
+    size_t peakBytes;
+
+    void add(size_t MemoryUsage::* structure, size_t bytes) {
+        usage.*structure += bytes;
+        peakBytes = std::max(peakBytes, usage.totalBytes());
+    }
+    void remove(size_t MemoryUsage::* structure, size_t bytes) {
+        usage.*structure -= bytes;
+    }
+};
+
+// Allocator accounting for the bytes of a container in one structure.
+template<typename T>
+struct CountingAllocator
+{
+    using value_type = T;
+
+    CountingAllocator(MemoryCounters* counters, size_t MemoryUsage::* structure)
+    : counters(counters), structure(structure) {}
+
+    template<typename U>
+    CountingAllocator(CountingAllocator<U> const& other)
+    : counters(other.counters), structure(other.structure) {}
+
+    T* allocate(size_t count) {
+        T* const pointer = std::allocator<T>{}.allocate(count);
+        counters->add(structure, count * sizeof(T));
+        return pointer;
+    }
+    void deallocate(T* pointer, size_t count) {
+        counters->remove(structure, count * sizeof(T));
+        std::allocator<T>{}.deallocate(pointer, count);
+    }
+
+    template<typename U>
+    bool operator==(CountingAllocator<U> const& other) const {
+        return counters == other.counters && structure == other.structure;
+    }
+
+    MemoryCounters* counters;
+    size_t MemoryUsage::* structure;
+};
+
+// Bytes allocated by a value on its own, beyond its size.
+template<typename T>
+size_t heapBytes(T const&) {
+    return 0;
+}
+
+inline size_t heapBytes(std::string const& value) {
+    // short strings are held within the object itself, up to the capacity
+    // of an empty string
+    static size_t const shortCapacity = std::string().capacity();
+    return value.capacity() > shortCapacity ? value.capacity() + 1 : 0;
+}
+
+template<int SizeX, int SizeY>
+size_t heapBytes(Grid<SizeX, SizeY> const& grid) {
+    return grid.pieces.capacity() * sizeof(Piece);
+}
+
+template<typename T>
+size_t heapBytes(std::optional<T> const& value) {
+    return value ? heapBytes(*value) : 0;
+}
+
+
+// Trees are not copyable, and can be moved from but not assigned to, as
+// their containers account for their bytes in counters of their own.
 template<typename Node, typename Edge, typename Key>
 struct SearchTree
 {
+    SearchTree() = default;
+    SearchTree(SearchTree&&) = default;
+    SearchTree(SearchTree const&) = delete;
+    SearchTree& operator=(SearchTree const&) = delete;
+
     bool append(Node const& node, Edge const& edge, Key const& key) {
         auto const [iter, inserted] = keys.insert(key);
         if (!inserted)
@@ -293,6 +493,9 @@ struct SearchTree
 
         nodes.push_back(node);
         edges.push_back(edge);
+        counters->add(&MemoryUsage::keysBytes, heapBytes(key));
+        counters->add(&MemoryUsage::nodesBytes, heapBytes(node));
+        counters->add(&MemoryUsage::edgesBytes, heapBytes(edge));
         return true;
     }
 
@@ -301,6 +504,8 @@ struct SearchTree
         size_t const b = edges.size();
 
         levels.push_back({a, b});
+        for (auto node = nodes.begin(); node != nodes.end() - (b - a); ++node)
+            counters->remove(&MemoryUsage::nodesBytes, heapBytes(*node));
         nodes.erase(nodes.begin(), nodes.end() - (b - a));
     }
 
@@ -308,6 +513,18 @@ struct SearchTree
         return levels.empty() ? IndexRange{0, 0} : levels.back();
     }
 
+    IndexRange depthAt(size_t depth) const {
+        return levels.at(depth);
+    }
+
+    size_t depthsCount() const {
+        return levels.size();
+    }
+
+    size_t size() const {
+        return edges.size();
+    }
+
     Node const& nodeAt(size_t index) const {
         size_t const offset = levels.empty() ? 0 : levels.back().a;
         if (index < offset)
@@ -341,11 +558,29 @@ struct SearchTree
         };
     }
 
+    MemoryUsage getMemoryUsage() const {
+        return counters->usage;
+    }
+
+    size_t peakMemoryBytes() const {
+        return counters->peakBytes;
+    }
+
 private:
-    std::deque<Node> nodes;
-    std::deque<Edge> edges;
-    std::deque<IndexRange> levels;
-    std::unordered_set<Key> keys;
+    template<typename T>
+    using Allocator = CountingAllocator<T>;
+
+    // counters are on the heap so that allocators can refer to them even
+    // when the tree is moved
+    std::unique_ptr<MemoryCounters> counters = std::make_unique<MemoryCounters>();
+    std::deque<Node, Allocator<Node>> nodes{
+        Allocator<Node>(counters.get(), &MemoryUsage::nodesBytes)};
+    std::deque<Edge, Allocator<Edge>> edges{
+        Allocator<Edge>(counters.get(), &MemoryUsage::edgesBytes)};
+    std::deque<IndexRange, Allocator<IndexRange>> levels{
+        Allocator<IndexRange>(counters.get(), &MemoryUsage::levelsBytes)};
+    std::unordered_set<Key, std::hash<Key>, std::equal_to<Key>, Allocator<Key>> keys{
+        0, std::hash<Key>{}, std::equal_to<Key>{}, Allocator<Key>(counters.get(), &MemoryUsage::keysBytes)};
 };
 
 #endif  // PUZZLE_TYPES_HPP_INCLUDED
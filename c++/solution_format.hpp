@@ -0,0 +1,185 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023  Bilal Djelassi
+
+#ifndef SOLUTION_FORMAT_HPP_INCLUDED
+#define SOLUTION_FORMAT_HPP_INCLUDED
+
+#include "puzzle_types.hpp"
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+
+// Packed solution record, all integers being little-endian:
+//
+//   offset  size  content
+//        0     4  magic "KSOL"
+//        4     1  format version
+//        5     1  grid size on x axis
+//        6     1  grid size on y axis
+//        7     1  pieces count
+//        8     8  hash of the starting grid, see boardHash()
+//       16     4  moves count
+//       20     n  one byte per move: piece index << 2 | Step::index()
+//
+// Records can be concatenated in a single stream.  Moves counts are bounded
+// far above the length of any solution, so that a corrupted header cannot
+// make the reader allocate gigabytes.
+struct PackedSolution
+{
+    static constexpr std::string_view Magic = "KSOL";
+    static constexpr uint8_t Version = 1;
+    static constexpr size_t HeaderSize = 20;
+    static constexpr size_t MaxPiecesCount = 64;
+    static constexpr size_t MaxMovesCount = 1 << 20;
+
+    uint8_t sizeX;
+    uint8_t sizeY;
+    uint8_t piecesCount;
+    uint64_t boardHash;
+    std::vector<Move> path;
+};
+
+// FNV-1a hash of the grid size, the obstacles, and the tag, position and
+// shape of each piece in order, which move piece indices refer to.
+template<typename Grid>
+uint64_t boardHash(Grid const& grid)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    auto const mix = [&](int value) {
+        for (int shift = 0; shift < 32; shift += 8) {
+            hash ^= uint8_t(value >> shift);
+            hash *= 0x100000001b3;
+        }
+    };
+    auto const mixCells = [&](PieceGeom const& geom) {
+        mix(int(geom.len));
+        for (auto const& cell : geom) {
+            mix(cell.x);
+            mix(cell.y);
+        }
+    };
+
+    mix(Grid::sizeX);
+    mix(Grid::sizeY);
+    mixCells(grid.obstacles);
+    mix(int(grid.pieces.size()));
+    for (auto const& piece : grid.pieces) {
+        mix(piece.tag.symbol);
+        mix(piece.tag.number);
+        mix(piece.position.x);
+        mix(piece.position.y);
+        mixCells(piece.geom);
+    }
+    return hash;
+}
+
+template<typename Grid>
+void writeSolution(std::ostream& out, Grid const& grid, std::vector<Move> const& path)
+{
+    static_assert(Grid::sizeX < 256 && Grid::sizeY < 256);
+
+    if (grid.pieces.size() > PackedSolution::MaxPiecesCount)
+        throw std::runtime_error("too many pieces for a packed solution");
+    if (path.size() > PackedSolution::MaxMovesCount)
+        throw std::runtime_error("too many moves for a packed solution");
+
+    std::vector<char> record(PackedSolution::HeaderSize + path.size());
+    auto const putInt = [&](size_t offset, uint64_t value, size_t size) {
+        for (size_t index = 0; index < size; ++index)
+            record[offset + index] = char(value >> (8 * index));
+    };
+
+    PackedSolution::Magic.copy(record.data(), PackedSolution::Magic.size());
+    putInt(4, PackedSolution::Version, 1);
+    putInt(5, Grid::sizeX, 1);
+    putInt(6, Grid::sizeY, 1);
+    putInt(7, grid.pieces.size(), 1);
+    putInt(8, boardHash(grid), 8);
+    putInt(16, path.size(), 4);
+
+    for (size_t moveIndex = 0; moveIndex < path.size(); ++moveIndex) {
+        auto const& move = path[moveIndex];
+        int const stepIndex = move.step.index();
+        if (move.pieceIndex >= grid.pieces.size() || stepIndex < 0)
+            throw std::runtime_error("move cannot be packed");
+
+        record[PackedSolution::HeaderSize + moveIndex] = char(move.pieceIndex << 2 | stepIndex);
+    }
+
+    out.write(record.data(), record.size());
+    if (!out)
+        throw std::runtime_error("error while writing packed solution");
+}
+
+// Reads the next record of a stream, or nothing if the stream ends before
+// the record starts.
+inline std::optional<PackedSolution> readSolution(std::istream& in)
+{
+    std::array<char, PackedSolution::HeaderSize> header;
+    in.read(header.data(), header.size());
+    if (in.gcount() == 0 && in.eof())
+        return std::nullopt;
+    if (!in)
+        throw std::runtime_error("truncated packed solution header");
+
+    auto const getInt = [&](size_t offset, size_t size) {
+        uint64_t value = 0;
+        for (size_t index = 0; index < size; ++index)
+            value |= uint64_t(uint8_t(header[offset + index])) << (8 * index);
+        return value;
+    };
+
+    if (std::string_view(header.data(), 4) != PackedSolution::Magic)
+        throw std::runtime_error("not a packed solution");
+    if (getInt(4, 1) != PackedSolution::Version)
+        throw std::runtime_error("unsupported packed solution version");
+
+    PackedSolution solution = {};
+    solution.sizeX = uint8_t(getInt(5, 1));
+    solution.sizeY = uint8_t(getInt(6, 1));
+    solution.piecesCount = uint8_t(getInt(7, 1));
+    solution.boardHash = getInt(8, 8);
+
+    size_t const movesCount = getInt(16, 4);
+    if (movesCount > PackedSolution::MaxMovesCount)
+        throw std::runtime_error("too many moves in packed solution");
+
+    std::vector<char> moves(movesCount);
+    in.read(moves.data(), moves.size());
+    if (!in)
+        throw std::runtime_error("truncated packed solution moves");
+
+    auto const steps = Step::all();
+    solution.path.reserve(moves.size());
+    for (char const byte : moves) {
+        size_t const pieceIndex = uint8_t(byte) >> 2;
+        if (pieceIndex >= solution.piecesCount)
+            throw std::runtime_error("out of bounds piece index in packed solution");
+        solution.path.push_back({pieceIndex, steps[byte & 3]});
+    }
+    return solution;
+}
+
+// Reads the next record of a stream and checks it belongs to the given grid.
+template<typename Grid>
+std::optional<std::vector<Move>> readSolution(std::istream& in, Grid const& grid)
+{
+    auto solution = readSolution(in);
+    if (!solution)
+        return std::nullopt;
+
+    if (solution->sizeX != Grid::sizeX || solution->sizeY != Grid::sizeY
+     || solution->piecesCount != grid.pieces.size()
+     || solution->boardHash != boardHash(grid))
+        throw std::runtime_error("packed solution does not belong to this grid");
+
+    return std::move(solution->path);
+}
+
+#endif  // SOLUTION_FORMAT_HPP_INCLUDED
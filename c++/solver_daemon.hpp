@@ -0,0 +1,290 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023  Bilal Djelassi
+
+#ifndef SOLVER_DAEMON_HPP_INCLUDED
+#define SOLVER_DAEMON_HPP_INCLUDED
+
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// the socket server needs Unix domain sockets, the cache is portable
+#if defined(__unix__) || defined(__APPLE__)
+#define SOLVER_DAEMON_SUPPORTED
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+
+// Least-recently-used cache bounded by an estimate of the memory it holds,
+// sizeOf(key, value) being the cost of one entry.  Thread-safe.
+template<typename Key, typename Value>
+struct LruCache
+{
+    using SizeOf = std::function<size_t (Key const&, Value const&)>;
+
+    struct Statistics {
+        size_t entriesCount;
+        size_t bytesCount;
+        size_t hitsCount;
+        size_t missesCount;
+        size_t evictionsCount;
+    };
+
+    LruCache(size_t maxBytes, SizeOf sizeOf)
+    : maxBytes(maxBytes), sizeOf(std::move(sizeOf)) {}
+
+    std::optional<Value> find(Key const& key) {
+        std::lock_guard lock(mutex);
+        auto const iter = index.find(key);
+        if (iter == index.end()) {
+            statistics.missesCount += 1;
+            return std::nullopt;
+        }
+        statistics.hitsCount += 1;
+        entries.splice(entries.begin(), entries, iter->second);
+        return iter->second->value;
+    }
+
+    void insert(Key const& key, Value value) {
+        std::lock_guard lock(mutex);
+        size_t const bytes = sizeOf(key, value);
+        if (bytes > maxBytes)
+            return;
+
+        auto const iter = index.find(key);
+        if (iter != index.end())
+            erase(iter->second);
+
+        entries.push_front({key, std::move(value), bytes});
+        index.emplace(key, entries.begin());
+        statistics.bytesCount += bytes;
+
+        while (statistics.bytesCount > maxBytes) {
+            erase(std::prev(entries.end()));
+            statistics.evictionsCount += 1;
+        }
+    }
+
+    Statistics getStatistics() const {
+        std::lock_guard lock(mutex);
+        Statistics result = statistics;
+        result.entriesCount = entries.size();
+        return result;
+    }
+
+private:
+    struct Entry {
+        Key key;
+        Value value;
+        size_t bytes;
+    };
+    using Iterator = typename std::list<Entry>::iterator;
+
+    void erase(Iterator entry) {
+        statistics.bytesCount -= entry->bytes;
+        index.erase(entry->key);
+        entries.erase(entry);
+    }
+
+    size_t const maxBytes;
+    SizeOf const sizeOf;
+    mutable std::mutex mutex;
+    std::list<Entry> entries;
+    std::unordered_map<Key, Iterator> index;
+    Statistics statistics = {};
+};
+
+
+#if defined(SOLVER_DAEMON_SUPPORTED)
+
+// Line-oriented server on a Unix domain socket.  Accepted connections are
+// handled by a pool of worker threads, each request line being answered by
+// the line returned by the handler.  A connection is closed by the client,
+// by sending the line "quit", or by sending a line longer than
+// MaxLineLength.  Destroying the server stops and joins the workers, after
+// shutting down the connections they are serving.
+struct SocketServer
+{
+    using Handler = std::function<std::string (std::string_view)>;
+
+    static constexpr size_t MaxLineLength = 4096;
+
+    SocketServer(std::string socketPath, size_t threadsCount, Handler handler)
+    : socketPath(std::move(socketPath)), threadsCount(threadsCount), handler(std::move(handler)) {}
+
+    SocketServer(SocketServer const&) = delete;
+    SocketServer& operator=(SocketServer const&) = delete;
+
+    ~SocketServer() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+            for (int const connection : connections)
+                ::close(connection);
+            connections.clear();
+            for (int const connection : served)
+                ::shutdown(connection, SHUT_RDWR);
+            available.notify_all();
+        }
+        for (auto& worker : workers)
+            worker.join();
+
+        if (listener >= 0)
+            ::close(listener);
+        if (bound)
+            ::unlink(socketPath.c_str());
+    }
+
+    // Listens until an error occurs, any stale socket file at the path being
+    // replaced, while any other file is left alone.
+    [[noreturn]] void run() {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (socketPath.size() >= sizeof(address.sun_path))
+            throw std::runtime_error("socket path is too long");
+        socketPath.copy(address.sun_path, socketPath.size());
+
+        struct stat status;
+        if (::lstat(socketPath.c_str(), &status) == 0) {
+            if (!S_ISSOCK(status.st_mode))
+                throw std::runtime_error("socket path is taken by a file other than a socket");
+            if (::unlink(socketPath.c_str()) < 0)
+                throw std::system_error(errno, std::generic_category(), "unlink");
+        }
+        else if (errno != ENOENT)
+            throw std::system_error(errno, std::generic_category(), "lstat");
+
+        listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0)
+            throw std::system_error(errno, std::generic_category(), "socket");
+
+        if (::bind(listener, reinterpret_cast<sockaddr const*>(&address), sizeof(address)) < 0)
+            throw std::system_error(errno, std::generic_category(), "bind");
+        bound = true;
+        if (::listen(listener, SOMAXCONN) < 0)
+            throw std::system_error(errno, std::generic_category(), "listen");
+
+        for (size_t index = 0; index < threadsCount; ++index)
+            workers.emplace_back(&SocketServer::work, this);
+
+        while (true) {
+            int const connection = ::accept(listener, nullptr, nullptr);
+            if (connection < 0) {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                throw std::system_error(errno, std::generic_category(), "accept");
+            }
+            std::lock_guard lock(mutex);
+            connections.push_back(connection);
+            available.notify_one();
+        }
+    }
+
+private:
+    void work() {
+        while (true) {
+            int connection;
+            {
+                std::unique_lock lock(mutex);
+                available.wait(lock, [this]() { return stopping || !connections.empty(); });
+                if (stopping)
+                    return;
+                connection = connections.front();
+                connections.pop_front();
+                served.insert(connection);
+            }
+            serve(connection);
+
+            std::lock_guard lock(mutex);
+            served.erase(connection);
+            ::close(connection);
+        }
+    }
+
+    void serve(int connection) const {
+        std::string pending;
+        char chunk[4096];
+
+        while (true) {
+            ssize_t const received = ::recv(connection, chunk, sizeof(chunk), 0);
+            if (received < 0 && errno == EINTR)
+                continue;
+            if (received <= 0)
+                return;
+            pending.append(chunk, received);
+
+            size_t lineEnd;
+            while ((lineEnd = pending.find('\n')) != std::string::npos) {
+                std::string_view line(pending.data(), lineEnd);
+                if (!line.empty() && line.back() == '\r')
+                    line.remove_suffix(1);
+                if (line == "quit")
+                    return;
+
+                std::string response;
+                try {
+                    response = handler(line);
+                }
+                catch (std::exception const& e) {
+                    response = std::string("error ") + e.what();
+                }
+                response.push_back('\n');
+                pending.erase(0, lineEnd + 1);
+
+                if (!sendAll(connection, response))
+                    return;
+            }
+
+            if (pending.size() > MaxLineLength) {
+                sendAll(connection, "error line too long\n");
+                return;
+            }
+        }
+    }
+
+    static bool sendAll(int connection, std::string_view data) {
+        while (!data.empty()) {
+            ssize_t const sent = ::send(connection, data.data(), data.size(), MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR)
+                continue;
+            if (sent <= 0)
+                return false;
+            data.remove_prefix(sent);
+        }
+        return true;
+    }
+
+    std::string const socketPath;
+    size_t const threadsCount;
+    Handler const handler;
+    int listener = -1;
+    bool bound = false;     // the socket file is ours to remove
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable available;
+    std::deque<int> connections;
+    std::unordered_set<int> served;
+    bool stopping = false;
+};
+
+#endif  // SOLVER_DAEMON_SUPPORTED
+
+#endif  // SOLVER_DAEMON_HPP_INCLUDED
@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023  Bilal Djelassi
+
+#ifndef SPSC_QUEUE_HPP_INCLUDED
+#define SPSC_QUEUE_HPP_INCLUDED
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+
+// Bounded lock-free queue between one producer thread and one consumer
+// thread.  Pushing to a full queue, or popping from an empty one, fails
+// rather than waits.
+template<typename T, size_t Capacity>
+struct SpscQueue
+{
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+        "capacity must be a power of two");
+
+    bool push(T const& value) {
+        size_t const back = tail.load(std::memory_order_relaxed);
+        if (back - head.load(std::memory_order_acquire) == Capacity)
+            return false;
+        items[back % Capacity] = value;
+        tail.store(back + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& value) {
+        size_t const front = head.load(std::memory_order_relaxed);
+        if (front == tail.load(std::memory_order_acquire))
+            return false;
+        value = items[front % Capacity];
+        head.store(front + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::array<T, Capacity> items;
+
+    // on their own cache lines, each one being written by a single thread
+    alignas(64) std::atomic<size_t> head = 0;
+    alignas(64) std::atomic<size_t> tail = 0;
+};
+
+#endif  // SPSC_QUEUE_HPP_INCLUDED
@@ -0,0 +1,402 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023  Bilal Djelassi
+
+#ifndef STATE_GRAPH_HPP_INCLUDED
+#define STATE_GRAPH_HPP_INCLUDED
+
+#include "puzzle_types.hpp"
+#include <algorithm>
+#include <array>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+// Complete graph of canonical configurations reachable from a set of seed
+// grids.  Each state keeps one representative grid, and its neighbors are
+// stored in compressed rows (edgeOffsets/edgeTargets), so that whole-graph
+// analyses never have to regenerate or revalidate moves.
+template<typename Grid>
+struct StateGraph
+{
+    using KeySymmetry = typename Grid::KeySymmetry;
+
+    static constexpr size_t unreachable = std::numeric_limits<size_t>::max();
+
+    std::vector<Grid> states;
+    std::vector<size_t> edgeOffsets;
+    std::vector<size_t> edgeTargets;
+    std::unordered_map<std::string, size_t> indices;
+    KeySymmetry symmetry;
+
+    static StateGraph explore(std::vector<Grid> const& seeds, KeySymmetry symmetry) {
+        StateGraph graph;
+        graph.symmetry = symmetry;
+
+        auto const insert = [&](Grid const& grid, std::string key) {
+            auto const [iter, inserted] = graph.indices.try_emplace(std::move(key), graph.states.size());
+            if (inserted)
+                graph.states.push_back(grid);
+            return iter->second;
+        };
+
+        for (auto const& seed : seeds) {
+            auto const validated = seed.validate();
+            if (!validated)
+                throw std::runtime_error("seed grid is invalid");
+            insert(seed, validated->key(symmetry));
+        }
+
+        // states are appended while being iterated, which makes this loop
+        // a breadth-first traversal building each row of edges in order
+        graph.edgeOffsets.push_back(0);
+        for (size_t stateIndex = 0; stateIndex < graph.states.size(); ++stateIndex) {
+            for (size_t const pieceIndex : IndexRange{0, graph.states[stateIndex].pieces.size()})
+            for (auto const& step : Step::all()) {
+                Grid grid = graph.states[stateIndex];
+                grid.apply(Move{pieceIndex, step});
+
+                auto const validated = grid.validate();
+                if (!validated)
+                    continue;
+
+                graph.edgeTargets.push_back(insert(grid, validated->key(symmetry)));
+            }
+            graph.edgeOffsets.push_back(graph.edgeTargets.size());
+        }
+        return graph;
+    }
+
+    size_t size() const {
+        return states.size();
+    }
+
+    size_t find(Grid const& grid) const {
+        auto const validated = grid.validate();
+        if (!validated)
+            return unreachable;
+
+        auto const iter = indices.find(validated->key(symmetry));
+        return iter != indices.end() ? iter->second : unreachable;
+    }
+
+    IndexRange edgesOf(size_t stateIndex) const {
+        return {edgeOffsets.at(stateIndex), edgeOffsets.at(stateIndex + 1)};
+    }
+
+    // Multi-source breadth-first search started from every state satisfying
+    // the goal.  Moves are reversible, so the distance found from the goals
+    // is the optimal move count towards the nearest goal.
+    std::vector<size_t> distancesTo(std::function<bool (Grid const&)> goal) const {
+        std::vector<size_t> distances(states.size(), unreachable);
+        std::deque<size_t> queue;
+
+        for (size_t stateIndex = 0; stateIndex < states.size(); ++stateIndex) {
+            if (goal(states[stateIndex])) {
+                distances[stateIndex] = 0;
+                queue.push_back(stateIndex);
+            }
+        }
+        while (!queue.empty()) {
+            size_t const stateIndex = queue.front();
+            queue.pop_front();
+
+            for (size_t const edgeIndex : edgesOf(stateIndex)) {
+                size_t const target = edgeTargets[edgeIndex];
+                if (distances[target] != unreachable)
+                    continue;
+
+                distances[target] = distances[stateIndex] + 1;
+                queue.push_back(target);
+            }
+        }
+        return distances;
+    }
+
+    // Labels connected components with repeated depth-first searches,
+    // components are numbered in order of their lowest state index.
+    std::vector<size_t> componentLabels() const {
+        std::vector<size_t> labels(states.size(), unreachable);
+        std::vector<size_t> stack;
+        size_t componentsCount = 0;
+
+        for (size_t seedIndex = 0; seedIndex < states.size(); ++seedIndex) {
+            if (labels[seedIndex] != unreachable)
+                continue;
+
+            labels[seedIndex] = componentsCount;
+            stack.push_back(seedIndex);
+            while (!stack.empty()) {
+                size_t const stateIndex = stack.back();
+                stack.pop_back();
+
+                for (size_t const edgeIndex : edgesOf(stateIndex)) {
+                    size_t const target = edgeTargets[edgeIndex];
+                    if (labels[target] != unreachable)
+                        continue;
+
+                    labels[target] = componentsCount;
+                    stack.push_back(target);
+                }
+            }
+            componentsCount += 1;
+        }
+        return labels;
+    }
+};
+
+
+// Connected components of a state graph, with their sizes and whether any of
+// their states satisfies the goal.  Once built, telling whether a grid can be
+// solved is a single key lookup.
+template<typename Grid>
+struct ComponentIndex
+{
+    StateGraph<Grid> graph;
+    std::vector<size_t> labels;
+    std::vector<size_t> sizes;
+    std::vector<bool> solvable;
+
+    ComponentIndex(StateGraph<Grid> graph, std::function<bool (Grid const&)> goal)
+    : graph(std::move(graph)) {
+        labels = this->graph.componentLabels();
+        for (size_t stateIndex = 0; stateIndex < labels.size(); ++stateIndex) {
+            size_t const label = labels[stateIndex];
+            if (label >= sizes.size()) {
+                sizes.resize(label + 1, 0);
+                solvable.resize(label + 1, false);
+            }
+            sizes[label] += 1;
+            if (!solvable[label] && goal(this->graph.states[stateIndex]))
+                solvable[label] = true;
+        }
+    }
+
+    size_t componentsCount() const {
+        return sizes.size();
+    }
+
+    size_t componentOf(Grid const& grid) const {
+        size_t const stateIndex = graph.find(grid);
+        if (stateIndex == StateGraph<Grid>::unreachable)
+            throw std::runtime_error("grid is not part of the indexed configurations");
+        return labels[stateIndex];
+    }
+
+    bool isSolvable(Grid const& grid) const {
+        return solvable[componentOf(grid)];
+    }
+};
+
+
+// Enumerates every valid placement of the pieces of a grid, regardless of
+// whether it can be reached from the grid itself.  Pieces sharing a symbol
+// are interchangeable (as they are in keys), so each layout of symbols is
+// produced once, pieces of a symbol being assigned in their original order.
+template<typename Grid>
+std::vector<Grid> enumeratePlacements(Grid const& pieceSet)
+{
+    constexpr int cellsCount = Grid::sizeX * Grid::sizeY;
+
+    struct SymbolGroup {
+        std::vector<size_t> pieceIndices;
+        std::vector<Vect2> cells;
+        size_t placed;
+    };
+    std::vector<SymbolGroup> groups;
+
+    for (size_t const pieceIndex : IndexRange{0, pieceSet.pieces.size()}) {
+        auto const& piece = pieceSet.pieces[pieceIndex];
+        if (piece.geom.empty())
+            throw std::runtime_error("cannot enumerate placements of an empty piece");
+
+        // anchor each shape on its first cell in row-major order
+        std::vector<Vect2> cells(piece.geom.begin(), piece.geom.end());
+        std::sort(cells.begin(), cells.end(), [](Vect2 const& lhs, Vect2 const& rhs) {
+            return lhs.y != rhs.y ? lhs.y < rhs.y : lhs.x < rhs.x;
+        });
+
+        auto group = std::find_if(groups.begin(), groups.end(), [&](SymbolGroup const& group) {
+            return pieceSet.pieces[group.pieceIndices.front()].tag.symbol == piece.tag.symbol;
+        });
+        if (group == groups.end()) {
+            groups.push_back({{pieceIndex}, cells, 0});
+            continue;
+        }
+        if (group->cells != cells)
+            throw std::runtime_error("pieces sharing a symbol must share a shape");
+        group->pieceIndices.push_back(pieceIndex);
+    }
+
+    std::array<bool, cellsCount> occupied = {};
+    int freeCount = cellsCount;
+    for (auto const& obstacle : pieceSet.obstacles) {
+        occupied.at(obstacle.y * Grid::sizeX + obstacle.x) = true;
+        freeCount -= 1;
+    }
+    for (auto const& piece : pieceSet.pieces)
+        freeCount -= int(piece.geom.len);
+    if (freeCount < 0)
+        throw std::runtime_error("pieces do not fit in the grid");
+
+    std::vector<Grid> placements;
+    Grid grid = pieceSet;
+
+    auto const fits = [&](Vect2 const& origin, std::vector<Vect2> const& cells) {
+        for (auto const& cell : cells) {
+            auto const position = origin + cell;
+            if (position.x < 0 || position.x >= Grid::sizeX
+             || position.y < 0 || position.y >= Grid::sizeY
+             || occupied[position.y * Grid::sizeX + position.x])
+                return false;
+        }
+        return true;
+    };
+    auto const mark = [&](Vect2 const& origin, std::vector<Vect2> const& cells, bool value) {
+        for (auto const& cell : cells) {
+            auto const position = origin + cell;
+            occupied[position.y * Grid::sizeX + position.x] = value;
+        }
+    };
+
+    std::function<void (int, int)> fill = [&](int cellIndex, int emptiesLeft) {
+        while (cellIndex < cellsCount && occupied[cellIndex])
+            ++cellIndex;
+        if (cellIndex == cellsCount) {
+            placements.push_back(grid);
+            return;
+        }
+        Vect2 const cell = {cellIndex % Grid::sizeX, cellIndex / Grid::sizeX};
+
+        if (emptiesLeft > 0)
+            fill(cellIndex + 1, emptiesLeft - 1);
+
+        for (auto& group : groups) {
+            if (group.placed == group.pieceIndices.size())
+                continue;
+
+            Vect2 const anchor = group.cells.front();
+            Vect2 const origin = {cell.x - anchor.x, cell.y - anchor.y};
+            if (!fits(origin, group.cells))
+                continue;
+
+            grid.pieces[group.pieceIndices[group.placed]].position = origin;
+            mark(origin, group.cells, true);
+            group.placed += 1;
+
+            fill(cellIndex + 1, emptiesLeft);
+
+            group.placed -= 1;
+            mark(origin, group.cells, false);
+        }
+    };
+    fill(0, freeCount);
+    return placements;
+}
+
+
+struct DifficultyReport
+{
+    size_t statesCount;
+    size_t unsolvableCount;
+    size_t maxDistance;
+    std::vector<size_t> hardestStates;
+    std::map<size_t, size_t> distribution;
+};
+
+inline DifficultyReport
+makeDifficultyReport(std::vector<size_t> const& distances, size_t unreachable) {
+    DifficultyReport report = {};
+    report.statesCount = distances.size();
+
+    for (size_t stateIndex = 0; stateIndex < distances.size(); ++stateIndex) {
+        size_t const distance = distances[stateIndex];
+        if (distance == unreachable) {
+            report.unsolvableCount += 1;
+            continue;
+        }
+        report.distribution[distance] += 1;
+
+        if (report.hardestStates.empty() || distance > report.maxDistance) {
+            report.maxDistance = distance;
+            report.hardestStates = {stateIndex};
+        }
+        else if (distance == report.maxDistance) {
+            report.hardestStates.push_back(stateIndex);
+        }
+    }
+    return report;
+}
+
+// Places the pieces of a grid at random, larger pieces first, each one at a
+// position drawn uniformly among those where it fits.  Placements where a
+// piece finds no room are started again from scratch.
+template<typename Grid, typename Random>
+Grid randomPlacement(Grid const& pieceSet, Random& random)
+{
+    constexpr int cellsCount = Grid::sizeX * Grid::sizeY;
+    constexpr int maxAttempts = 1000;
+
+    std::vector<size_t> order(pieceSet.pieces.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+        return pieceSet.pieces[lhs].geom.len > pieceSet.pieces[rhs].geom.len;
+    });
+    for (auto const& piece : pieceSet.pieces)
+        if (piece.geom.empty())
+            throw std::runtime_error("cannot place an empty piece");
+
+    for (int attempt = 0; attempt < maxAttempts; ++attempt) {
+        Grid grid = pieceSet;
+        std::array<bool, cellsCount> occupied = {};
+        for (auto const& obstacle : grid.obstacles)
+            occupied.at(obstacle.y * Grid::sizeX + obstacle.x) = true;
+
+        auto const fits = [&](Piece const& piece, Vect2 const& origin) {
+            for (auto const& cell : piece.geom) {
+                auto const position = origin + cell;
+                if (position.x < 0 || position.x >= Grid::sizeX
+                 || position.y < 0 || position.y >= Grid::sizeY
+                 || occupied[position.y * Grid::sizeX + position.x])
+                    return false;
+            }
+            return true;
+        };
+
+        bool placed = true;
+        std::vector<Vect2> origins;
+        for (size_t const pieceIndex : order) {
+            auto& piece = grid.pieces[pieceIndex];
+            Vect2 const first = *piece.geom.begin();
+
+            origins.clear();
+            for (int y = 0; y < Grid::sizeY; ++y)
+                for (int x = 0; x < Grid::sizeX; ++x)
+                    if (Vect2 const origin = {x - first.x, y - first.y}; fits(piece, origin))
+                        origins.push_back(origin);
+            if (origins.empty()) {
+                placed = false;
+                break;
+            }
+
+            std::uniform_int_distribution<size_t> pick(0, origins.size() - 1);
+            piece.position = origins[pick(random)];
+            for (auto const& cell : piece.geom) {
+                auto const position = piece.position + cell;
+                occupied[position.y * Grid::sizeX + position.x] = true;
+            }
+        }
+        if (placed)
+            return grid;
+    }
+    throw std::runtime_error("could not find room for all pieces");
+}
+
+#endif  // STATE_GRAPH_HPP_INCLUDED
@@ -5,12 +5,23 @@
 #define SVG_RENDERER_HPP_INCLUDED
 
 #include "puzzle_types.hpp"
+#include "worker_pool.hpp"
 #include "xml_writer.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <exception>
 #include <format>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <iostream>
 #include <optional>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
@@ -27,8 +38,32 @@ struct SVGRenderer
     float borderRadius;
     int   gridsPerRow;
     bool  includeBackground;
+    float animationStepDuration;
     std::unordered_map<std::string, std::string> properties;
 
+    struct PieceColors
+    {
+        bool defined;
+        std::string fillHi;
+        std::string fillLo;
+        std::string strokeHi;
+        std::string strokeLo;
+    };
+
+    struct Theme
+    {
+        std::string fontFamily;
+        std::string fontSize;
+        std::string strokeWidthGrid;
+        std::string strokeWidthPiece;
+        std::string backgroundColor;
+        std::string textColor;
+        std::string arrowColor;
+        std::string fillColorGrid;
+        std::string strokeColorGrid;
+        std::array<PieceColors, 128> pieces;
+    };
+
     SVGRenderer() {
         cellGap = 4.0f;
         gridGap = 16.0f;
@@ -39,6 +74,7 @@ struct SVGRenderer
         borderRadius = 2.0f;
         gridsPerRow = 10;
         includeBackground = false;
+        animationStepDuration = 0.5f;
     }
     virtual ~SVGRenderer() {}
 
@@ -141,6 +177,33 @@ struct SVGRenderer
         throw std::runtime_error("cannot find property " + key);
     }
 
+    // Properties resolved into direct slots, piece colors being indexed by
+    // piece symbol.  Must be called again after editing properties.
+    void compileTheme() {
+        theme.fontFamily = property("fontFamily");
+        theme.fontSize = property("fontSize");
+        theme.strokeWidthGrid = property("strokeWidthGrid");
+        theme.strokeWidthPiece = property("strokeWidthPiece");
+        theme.backgroundColor = property("backgroundColor");
+        theme.textColor = property("textColor");
+        theme.arrowColor = property("arrowColor");
+        theme.fillColorGrid = property("fillColorGrid");
+        theme.strokeColorGrid = property("strokeColorGrid");
+
+        for (size_t index = 0; index < theme.pieces.size(); ++index) {
+            auto const symbol = std::string(1, char(index));
+            auto& colors = theme.pieces[index];
+            colors.defined = properties.contains("fillColorHiPiece" + symbol);
+            if (!colors.defined)
+                continue;
+
+            colors.fillHi = property("fillColorHiPiece" + symbol);
+            colors.fillLo = property("fillColorLoPiece" + symbol);
+            colors.strokeHi = property("strokeColorHiPiece" + symbol);
+            colors.strokeLo = property("strokeColorLoPiece" + symbol);
+        }
+    }
+
     void renderGrid(std::ostream& out, Grid const& grid) const {
         float const svgSizeX = getSVGSizeX(1);
         float const svgSizeY = getSVGSizeY(1, false);
@@ -148,8 +211,8 @@ struct SVGRenderer
         XmlWriter svg(out);
         svg.decl()
            .root("svg")
-           .attr("width", std::format("{}", svgSizeX))
-           .attr("height", std::format("{}", svgSizeY))
+           .attr("width", svgSizeX)
+           .attr("height", svgSizeY)
            .attr("xmlns", "http://www.w3.org/2000/svg")
            .attr("xmlns:xlink", "http://www.w3.org/1999/xlink");
 
@@ -159,7 +222,7 @@ struct SVGRenderer
             svg.elem("rect")
                .attr("width", "100%")
                .attr("height", "100%")
-               .attr("fill", property("backgroundColor"))
+               .attr("fill", theme.backgroundColor)
                .term();
         }
 
@@ -170,7 +233,76 @@ struct SVGRenderer
     }
 
     void renderGrids(std::ostream& out, Grid const& grid, std::vector<Move> const& path) const {
-        int const gridCount = 1 + path.size() + 1;
+        renderFrames(out, grid, path, {0, framesCount(path)});
+    }
+
+    // Renders a solution as a single animated grid.  The grid and pieces are
+    // drawn once, and each move only adds a keyframe to the moving piece, so
+    // the size of the output grows with the number of moves.
+    void renderAnimation(std::ostream& out, Grid const& grid, std::vector<Move> const& path) const {
+        float const svgSizeX = getSVGSizeX(1);
+        float const svgSizeY = getSVGSizeY(1, false);
+
+        std::vector<std::vector<Keyframe>> keyframes(grid.pieces.size());
+        Grid currentGrid = grid;
+        for (size_t moveIndex = 0; moveIndex < path.size(); ++moveIndex) {
+            auto const& move = path[moveIndex];
+            Vect2 const from = currentGrid.pieces.at(move.pieceIndex).position;
+            currentGrid.apply(move);
+            Vect2 const to = currentGrid.pieces[move.pieceIndex].position;
+
+            keyframes[move.pieceIndex].push_back({moveIndex * animationStepDuration, from, to});
+        }
+
+        XmlWriter svg(out);
+        svg.decl()
+           .root("svg")
+           .attr("width", svgSizeX)
+           .attr("height", svgSizeY)
+           .attr("xmlns", "http://www.w3.org/2000/svg")
+           .attr("xmlns:xlink", "http://www.w3.org/1999/xlink");
+
+        preRender(svg, grid);
+
+        if (includeBackground) {
+            svg.elem("rect")
+               .attr("width", "100%")
+               .attr("height", "100%")
+               .attr("fill", theme.backgroundColor)
+               .term();
+        }
+
+        svg.elem("g")
+           .attr("transform", "translate(", gridPositionToXCoord(0), " ", gridPositionToYCoord(0), ")");
+
+        render(svg, grid, std::nullopt);
+        for (size_t pieceIndex = 0; pieceIndex < grid.pieces.size(); ++pieceIndex)
+            renderAnimated(svg, grid.pieces[pieceIndex], keyframes[pieceIndex]);
+
+        svg.term();
+        svg.term();
+        if (!svg.success())
+            throw std::runtime_error("error while generating SVG");
+    }
+
+    // Number of frames showing a solution: the starting grid, one frame
+    // per move, and the solved grid.
+    static size_t framesCount(std::vector<Move> const& path) {
+        return 1 + path.size() + 1;
+    }
+
+    // Renders frames [frames.a, frames.b) of a solution.  Frame 0 shows the
+    // starting grid, frame i shows the grid before path[i - 1] is applied,
+    // and the last frame shows the solved grid.  The snapshot must be the
+    // grid shown on the first rendered frame.
+    void renderFrames(std::ostream& out, Grid const& snapshot,
+        std::vector<Move> const& path, IndexRange frames) const {
+
+        size_t const lastFrame = framesCount(path) - 1;
+        if (frames.isEmpty() || frames.b > lastFrame + 1)
+            throw std::runtime_error("invalid range of frames");
+
+        int const gridCount = frames.b - frames.a;
         int const gridsOnXAxis = getGridsOnXAxis(gridCount);
         int const gridsOnYAxis = getGridsOnYAxis(gridCount);
 
@@ -180,48 +312,137 @@ struct SVGRenderer
         XmlWriter svg(out);
         svg.decl()
            .root("svg")
-           .attr("width", std::format("{}", svgSizeX))
-           .attr("height", std::format("{}", svgSizeY))
+           .attr("width", svgSizeX)
+           .attr("height", svgSizeY)
            .attr("xmlns", "http://www.w3.org/2000/svg")
            .attr("xmlns:xlink", "http://www.w3.org/1999/xlink");
 
-        preRender(svg, grid);
+        preRender(svg, snapshot);
 
 
         if (includeBackground) {
             svg.elem("rect")
                .attr("width", "100%")
                .attr("height", "100%")
-               .attr("fill", property("backgroundColor"))
+               .attr("fill", theme.backgroundColor)
                .term();
         }
 
         int gridPosX = 0;
         int gridPosY = 0;
-        Grid currentGrid = grid;
-        render(svg, gridPosX, gridPosY, currentGrid, std::nullopt, "début");
-
-        for (size_t moveIndex = 0; moveIndex < path.size(); moveIndex += 1) {
-            auto const& move = path[moveIndex];
-            auto const& title = std::format("étape {}", moveIndex + 1);
-
-            nextGridPosition(gridPosX, gridPosY);
-            render(svg, gridPosX, gridPosY, currentGrid, move, title);
+        Grid currentGrid = snapshot;
+
+        std::string_view const titlePrefix = "étape ";
+        char title[32];
+        titlePrefix.copy(title, titlePrefix.size());
+
+        for (size_t const frame : frames) {
+            if (frame != frames.a)
+                nextGridPosition(gridPosX, gridPosY);
+
+            if (frame == 0) {
+                render(svg, gridPosX, gridPosY, currentGrid, std::nullopt, "début");
+                continue;
+            }
+            if (frame == lastFrame) {
+                render(svg, gridPosX, gridPosY, currentGrid, std::nullopt, "fin");
+                continue;
+            }
+
+            auto const& move = path[frame - 1];
+            auto const titleEnd = std::to_chars(
+                title + titlePrefix.size(), std::end(title), frame).ptr;
+
+            render(svg, gridPosX, gridPosY, currentGrid, move,
+                std::string_view(title, titleEnd - title));
             currentGrid.apply(move);
         }
 
-        nextGridPosition(gridPosX, gridPosY);
-        render(svg, gridPosX, gridPosY, currentGrid, std::nullopt, "fin");
-
         svg.term();
         if (!svg.success())
             throw std::runtime_error("error while generating SVG");
     }
 
+    // Renders a solution as a series of sheets of at most framesPerSheet
+    // frames, sheet i being written to the stream returned by openSheet(i).
+    // Sheets are rendered in parallel by up to threadsCount workers, each
+    // replaying the path from a snapshot of the grid taken beforehand at
+    // the start of its sheet.  openSheet is called from the workers.
+    void renderSheets(Grid const& grid, std::vector<Move> const& path,
+        size_t framesPerSheet, size_t threadsCount,
+        std::function<std::unique_ptr<std::ostream> (size_t)> const& openSheet) const {
+
+        if (framesPerSheet == 0)
+            throw std::runtime_error("sheets must hold at least one frame");
+
+        size_t const framesTotal = framesCount(path);
+        size_t const sheetsCount = (framesTotal + framesPerSheet - 1) / framesPerSheet;
+
+        std::vector<Grid> snapshots;
+        snapshots.reserve(sheetsCount);
+        Grid currentGrid = grid;
+        size_t movesApplied = 0;
+        for (size_t sheetIndex = 0; sheetIndex < sheetsCount; ++sheetIndex) {
+            size_t const firstFrame = sheetIndex * framesPerSheet;
+            size_t const movesBefore = firstFrame == 0 ? 0 : firstFrame - 1;
+
+            for (; movesApplied < movesBefore; ++movesApplied)
+                currentGrid.apply(path[movesApplied]);
+            snapshots.push_back(currentGrid);
+        }
+
+        std::atomic<size_t> nextSheet = 0;
+        std::mutex errorMutex;
+        std::exception_ptr error;
+
+        auto const worker = [&]() {
+            for (size_t sheetIndex = nextSheet++; sheetIndex < sheetsCount; sheetIndex = nextSheet++) {
+                try {
+                    size_t const firstFrame = sheetIndex * framesPerSheet;
+                    IndexRange const frames = {
+                        firstFrame, std::min(firstFrame + framesPerSheet, framesTotal)};
+
+                    auto const out = openSheet(sheetIndex);
+                    renderFrames(*out, snapshots[sheetIndex], path, frames);
+                }
+                catch (...) {
+                    std::lock_guard lock(errorMutex);
+                    if (!error)
+                        error = std::current_exception();
+                    nextSheet = sheetsCount;
+                }
+            }
+        };
+
+        size_t const workersCount = std::clamp<size_t>(sheetsCount, 1, std::max<size_t>(threadsCount, 1));
+        WorkerPool(workersCount).run(worker, workersCount);
+
+        if (error)
+            std::rethrow_exception(error);
+    }
+
 protected:
+    Theme theme;
+
+    // a piece moving from one position to another, begin being in seconds
+    struct Keyframe
+    {
+        float begin;
+        Vect2 from;
+        Vect2 to;
+    };
+
+    PieceColors const& pieceColors(char symbol) const {
+        auto const index = static_cast<unsigned char>(symbol);
+        if (index >= theme.pieces.size() || !theme.pieces[index].defined)
+            throw std::runtime_error(std::format("no colors defined for piece {}", symbol));
+        return theme.pieces[index];
+    }
+
     virtual void preRender(XmlWriter&, Grid const&) const = 0;
-    virtual void render(XmlWriter&, Grid const&, std::optional<std::string>) const = 0;
+    virtual void render(XmlWriter&, Grid const&, std::optional<std::string_view>) const = 0;
     virtual void render(XmlWriter&, Piece const&, std::optional<Step>) const = 0;
+    virtual void renderAnimated(XmlWriter&, Piece const&, std::vector<Keyframe> const&) const = 0;
 
     int getGridsOnXAxis(int gridCount) const {
         return gridCount <= gridsPerRow ? gridCount : gridsPerRow;
@@ -267,13 +488,13 @@ private:
             int gridPosY,
             Grid const& grid,
             std::optional<Move> move,
-            std::optional<std::string> title) const {
+            std::optional<std::string_view> title) const {
 
         float const gridCoordX = gridPositionToXCoord(gridPosX);
         float const gridCoordY = gridPositionToYCoord(gridPosY, bool(title));
 
         svg.elem("g")
-           .attr("transform", std::format("translate({} {})", gridCoordX, gridCoordY));
+           .attr("transform", "translate(", gridCoordX, " ", gridCoordY, ")");
 
         render(svg, grid, title);
         for (size_t pieceIndex = 0; pieceIndex < grid.pieces.size(); ++pieceIndex) {
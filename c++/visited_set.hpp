@@ -0,0 +1,272 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023  Bilal Djelassi
+
+#ifndef VISITED_SET_HPP_INCLUDED
+#define VISITED_SET_HPP_INCLUDED
+
+#include "huge_page_allocator.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+
+// Open-addressing hash set of keys with linear probing.  Callers pass the
+// hash of each key, so that it is computed once, and can prefetch the slot
+// of a key some time before inserting it.  Key{} is reserved to mark empty
+// slots, and is never a valid key.
+template<typename Key, typename Hash>
+struct VisitedSet
+{
+    static constexpr size_t InitialCapacity = 1024;
+
+    VisitedSet() {
+        clear();
+    }
+
+    // tells whether the key was inserted, false meaning it was already there
+    bool insert(Key const& key, size_t hash) {
+        if (2 * (count + 1) > slots.size())
+            grow();
+
+        for (size_t index = hash & mask;; index = (index + 1) & mask) {
+            Key& slot = slots[index];
+            if (slot == Key{}) {
+                slot = key;
+                count += 1;
+                return true;
+            }
+            if (slot == key)
+                return false;
+        }
+    }
+
+    void prefetch(size_t hash) const {
+#if defined(__GNUC__)
+        __builtin_prefetch(&slots[hash & mask], 1);
+#endif
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    size_t capacity() const {
+        return slots.size();
+    }
+
+    void clear() {
+        slots.assign(InitialCapacity, Key{});
+        mask = InitialCapacity - 1;
+        count = 0;
+    }
+
+private:
+    void grow() {
+        HugePageVector<Key> previous(2 * slots.size(), Key{});
+        std::swap(previous, slots);
+        mask = slots.size() - 1;
+
+        for (auto const& key : previous) {
+            if (key == Key{})
+                continue;
+            size_t index = Hash{}(key) & mask;
+            while (slots[index] != Key{})
+                index = (index + 1) & mask;
+            slots[index] = key;
+        }
+    }
+
+    HugePageVector<Key> slots;
+    size_t mask;
+    size_t count;
+};
+
+
+// Hash set of 64-bit keys taking insertions from several threads at once,
+// without locks.  Keys are spread over shards by the high bits of their
+// hash, each shard being an open-addressing table whose empty slots are
+// claimed by compare-and-swap.  A shard getting too loaded grows on its
+// own: a table twice as large is chained after the current one, and the
+// threads inserting into the shard move keys over chunk by chunk before
+// inserting, rather than waiting for one thread to move them all.  Slots
+// are sealed once moved, so that keys inserted meanwhile are either moved
+// or inserted into the new table, and found there by the next insertion.
+// Tables left behind are only freed with the set.  Keys 0 and ~0 are
+// reserved to mark empty and sealed slots.  The engines do not use it, as
+// they merge children on one thread to keep solutions deterministic.
+template<typename Hash>
+struct ConcurrentVisitedSet
+{
+    static constexpr uint64_t Empty = 0;
+    static constexpr uint64_t Sealed = ~uint64_t(0);
+    static constexpr size_t MoveChunkSize = 1024;
+
+    explicit ConcurrentVisitedSet(int shardBits = 6, size_t initialCapacity = 1024)
+    : shardBits(shardBits), shards(size_t(1) << shardBits) {
+        if (shardBits < 1 || shardBits > 16)
+            throw std::runtime_error("unsupported number of shards");
+        if (initialCapacity == 0 || (initialCapacity & (initialCapacity - 1)) != 0)
+            throw std::runtime_error("capacity of shards must be a power of two");
+
+        for (auto& shard : shards) {
+            shard.first = std::make_unique<Table>(initialCapacity);
+            shard.current = shard.first.get();
+        }
+    }
+
+    // tells whether the key was inserted, false meaning it was already there
+    bool insert(uint64_t key) {
+        if (key == Empty || key == Sealed)
+            throw std::runtime_error("reserved key");
+
+        uint64_t const hash = Hash{}(key);
+        Shard& shard = shards[hash >> (64 - shardBits)];
+
+        Table* table = shard.current.load(std::memory_order_acquire);
+        while (true) {
+            if (Table* const next = table->next.load(std::memory_order_acquire)) {
+                moveKeys(shard, *table, *next);
+                if (table->movedChunks.load(std::memory_order_acquire) == table->chunksCount()) {
+                    table = next;
+                    continue;
+                }
+            }
+
+            switch (insertInto(*table, key, hash)) {
+            case Found:
+                return false;
+            case Inserted:
+                shard.keysCount.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            case Elsewhere:
+                table = &grow(*table);
+                break;
+            }
+        }
+    }
+
+    // exact once insertions are over
+    size_t size() const {
+        size_t count = 0;
+        for (auto const& shard : shards)
+            count += shard.keysCount.load(std::memory_order_relaxed);
+        return count;
+    }
+
+    // slots of the largest table of each shard, once insertions are over
+    size_t capacity() const {
+        size_t count = 0;
+        for (auto const& shard : shards) {
+            Table const* table = shard.current.load(std::memory_order_acquire);
+            while (Table const* const next = table->next.load(std::memory_order_acquire))
+                table = next;
+            count += table->slots.size();
+        }
+        return count;
+    }
+
+private:
+    struct Table {
+        explicit Table(size_t capacity)
+        : slots(capacity), mask(capacity - 1) {}
+
+        ~Table() {
+            delete next.load();
+        }
+
+        size_t chunksCount() const {
+            return (slots.size() + MoveChunkSize - 1) / MoveChunkSize;
+        }
+
+        HugePageVector<std::atomic<uint64_t>> slots;
+        size_t const mask;
+        std::atomic<size_t> keysCount = 0;      // including keys moved here
+        std::atomic<Table*> next = nullptr;     // owned
+        std::atomic<size_t> nextChunk = 0;
+        std::atomic<size_t> movedChunks = 0;
+    };
+
+    struct alignas(64) Shard {
+        std::unique_ptr<Table> first;
+        std::atomic<Table*> current;
+        std::atomic<size_t> keysCount = 0;
+    };
+
+    enum Outcome {
+        Found,
+        Inserted,
+        Elsewhere,  // reached a sealed slot, or a full table
+    };
+
+    Outcome insertInto(Table& table, uint64_t key, uint64_t hash) {
+        size_t index = hash & table.mask;
+        for (size_t probe = 0; probe <= table.mask; ++probe, index = (index + 1) & table.mask) {
+            auto& slot = table.slots[index];
+            uint64_t value = slot.load(std::memory_order_acquire);
+            while (value == Empty) {
+                if (slot.compare_exchange_weak(value, key, std::memory_order_acq_rel)) {
+                    if (2 * (table.keysCount.fetch_add(1, std::memory_order_relaxed) + 1) > table.slots.size())
+                        grow(table);
+                    return Inserted;
+                }
+            }
+            if (value == key)
+                return Found;
+            if (value == Sealed)
+                return Elsewhere;
+        }
+        return Elsewhere;
+    }
+
+    // chains a larger table after the given one, if not done yet
+    Table& grow(Table& table) {
+        Table* next = table.next.load(std::memory_order_acquire);
+        if (next == nullptr) {
+            auto larger = std::make_unique<Table>(2 * table.slots.size());
+            if (table.next.compare_exchange_strong(next, larger.get(), std::memory_order_acq_rel))
+                next = larger.release();
+        }
+        return *next;
+    }
+
+    // moves chunks of keys of a table to the next one until none is left
+    void moveKeys(Shard& shard, Table& table, Table& next) {
+        size_t const chunksCount = table.chunksCount();
+        for (size_t chunk = table.nextChunk.fetch_add(1, std::memory_order_relaxed);
+                    chunk < chunksCount;
+                    chunk = table.nextChunk.fetch_add(1, std::memory_order_relaxed)) {
+
+            size_t const end = std::min((chunk + 1) * MoveChunkSize, table.slots.size());
+            for (size_t index = chunk * MoveChunkSize; index < end; ++index) {
+                auto& slot = table.slots[index];
+                uint64_t value = slot.load(std::memory_order_acquire);
+                while (value == Empty)
+                    if (slot.compare_exchange_weak(value, Sealed, std::memory_order_acq_rel))
+                        break;
+                if (value == Empty || value == Sealed)
+                    continue;
+
+                // the next table may itself be growing already
+                Table* target = &next;
+                uint64_t const hash = Hash{}(value);
+                while (insertInto(*target, value, hash) == Elsewhere)
+                    target = &grow(*target);
+            }
+
+            if (table.movedChunks.fetch_add(1, std::memory_order_acq_rel) + 1 == chunksCount) {
+                Table* expected = &table;
+                shard.current.compare_exchange_strong(expected, &next, std::memory_order_acq_rel);
+            }
+        }
+    }
+
+    int const shardBits;
+    std::vector<Shard> shards;
+};
+
+#endif  // VISITED_SET_HPP_INCLUDED
@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023  Bilal Djelassi
+
+#ifndef WORKER_POOL_HPP_INCLUDED
+#define WORKER_POOL_HPP_INCLUDED
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Threads started once and woken for each job, so that jobs much shorter
+// than starting a thread can still be shared.  Threads are started on the
+// first job needing them, and only as many as a job asks for are woken.
+// Jobs are run by one thread at a time, which takes part in them.
+struct WorkerPool
+{
+    // the calling thread counts as one of the threads
+    explicit WorkerPool(size_t maxThreadsCount)
+    : maxThreadsCount(std::max<size_t>(maxThreadsCount, 1)) {}
+
+    WorkerPool(WorkerPool const&) = delete;
+    WorkerPool& operator=(WorkerPool const&) = delete;
+
+    ~WorkerPool() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        started.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    // Runs the job on the given number of threads at most, the calling one
+    // included, and returns once all of them are done.  The job must not
+    // throw.
+    void run(std::function<void ()> const& job, size_t threadsCount) {
+        size_t const helpersCount = std::min(threadsCount, maxThreadsCount) - 1;
+        if (helpersCount == 0) {
+            job();
+            return;
+        }
+        while (workers.size() < helpersCount)
+            workers.emplace_back(&WorkerPool::work, this);
+        {
+            std::lock_guard lock(mutex);
+            currentJob = &job;
+            ticketsCount = helpersCount;
+            pendingCount = helpersCount;
+        }
+        for (size_t index = 0; index < helpersCount; ++index)
+            started.notify_one();
+        job();
+
+        std::unique_lock lock(mutex);
+        finished.wait(lock, [this]() { return pendingCount == 0; });
+        currentJob = nullptr;
+    }
+
+private:
+    void work() {
+        while (true) {
+            std::function<void ()> const* job;
+            {
+                std::unique_lock lock(mutex);
+                started.wait(lock, [this]() { return stopping || ticketsCount > 0; });
+                if (stopping)
+                    return;
+                ticketsCount -= 1;
+                job = currentJob;
+            }
+            (*job)();
+
+            std::lock_guard lock(mutex);
+            if (--pendingCount == 0)
+                finished.notify_one();
+        }
+    }
+
+    size_t const maxThreadsCount;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable started;
+    std::condition_variable finished;
+    std::function<void ()> const* currentJob = nullptr;
+    size_t ticketsCount = 0;
+    size_t pendingCount = 0;
+    bool stopping = false;
+};
+
+#endif  // WORKER_POOL_HPP_INCLUDED
@@ -4,28 +4,57 @@
 #ifndef XML_WRITER_HPP_INCLUDED
 #define XML_WRITER_HPP_INCLUDED
 
+#include <charconv>
 #include <iostream>
-#include <stack>
+#include <iterator>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <vector>
 
 struct XmlEscaped
 {
     std::string_view value;
+
+    static constexpr std::string_view specialChars = "\"'<>&";
+
+    static constexpr std::string_view entity(char c) {
+        switch (c) {
+        case '\"': return "&quot;";
+        case '\'': return "&apos;";
+        case '<':  return "&lt;";
+        case '>':  return "&gt;";
+        case '&':  return "&amp;";
+        default:   return {};
+        }
+    }
+
+    // calls sink with each run of unescaped characters and each entity
+    template<typename Sink>
+    void forEachRun(Sink&& sink) const {
+        size_t begin = 0;
+        while (begin < value.size()) {
+            size_t const end = value.find_first_of(specialChars, begin);
+            if (end == std::string_view::npos) {
+                sink(value.substr(begin));
+                return;
+            }
+            if (end > begin)
+                sink(value.substr(begin, end - begin));
+            sink(entity(value[end]));
+            begin = end + 1;
+        }
+    }
 };
 
 inline std::ostream&
 operator<<(std::ostream& out, XmlEscaped const& escaped)
 {
-    for (char c : escaped.value) {
-        switch (c) {
-        case '\"': out << "&quot;"; break;
-        case '\'': out << "&apos;"; break;
-        case '<':  out << "&lt;";   break;
-        case '>':  out << "&gt;";   break;
-        case '&':  out << "&amp;";  break;
-        default:   out << c;        break;
-        }
-    }
+    escaped.forEachRun([&](std::string_view run) {
+        out.write(run.data(), run.size());
+    });
     return out;
 }
 
@@ -45,15 +74,30 @@ struct XmlWriter
     static constexpr std::string_view StandardXmlDecl =
         "<?xml version=\"1.0\" encoding=\"utf-8\"?>";
 
+    // output is accumulated in a contiguous buffer and written to the
+    // stream in blocks of about this size
+    static constexpr size_t FlushThreshold = 64 * 1024;
+
     explicit XmlWriter(std::ostream& out)
-        : out(out), elements(), state(ExpectingDeclaration | ExpectingRoot) {}
+        : out(out), buffer(), names(), elements(), state(ExpectingDeclaration | ExpectingRoot) {
+        buffer.reserve(2 * FlushThreshold);
+    }
+
+    XmlWriter(XmlWriter const&) = delete;
+    XmlWriter& operator=(XmlWriter const&) = delete;
+
+    ~XmlWriter() {
+        flush();
+    }
 
     XmlWriter& decl(std::string_view xmlDecl = StandardXmlDecl) {
         if (!(state & ExpectingDeclaration))
             throw std::runtime_error("unexpected declaration");
 
-        if (!xmlDecl.empty())
-            out << xmlDecl << "\n";
+        if (!xmlDecl.empty()) {
+            put(xmlDecl);
+            put('\n');
+        }
 
         state = ExpectingRoot;
         return *this;
@@ -66,20 +110,29 @@ struct XmlWriter
         if (!validName(name))
             throw std::runtime_error("invalid name for root element");
 
-        out << "<" << name;
-        elements.push(ElementStatus{std::string(name), true});
+        put('<');
+        put(name);
+        pushElement(name);
         state = ExpectingAttribute | ExpectingContent | ExpectingElement;
         return *this;
     }
 
-    XmlWriter& attr(std::string_view name, std::string_view value) {
+    // The value of an attribute is the concatenation of its parts, strings
+    // are escaped and numbers are written in their shortest representation,
+    // e.g. attr("transform", "translate(", x, " ", y, ")").
+    template<typename... Parts>
+    XmlWriter& attr(std::string_view name, Parts const&... parts) {
         if (!(state & ExpectingAttribute))
             throw std::runtime_error("unexpected attribute");
 
         if (!validName(name))
             throw std::runtime_error("invalid name for attribute");
 
-        out << " " << name << "=\"" << XmlEscaped{value} << "\"";
+        put(' ');
+        put(name);
+        put("=\"");
+        (putValue(parts), ...);
+        put('"');
         return *this;
     }
 
@@ -88,10 +141,10 @@ struct XmlWriter
             throw std::runtime_error("unexpected content");
 
         if (state & ExpectingAttribute)
-            out << ">";
-        out << XmlEscaped{data};
+            put('>');
+        putValue(data);
 
-        elements.top().empty = false;
+        elements.back().empty = false;
         state = ExpectingContent | ExpectingElement;
         return *this;
     }
@@ -104,11 +157,12 @@ struct XmlWriter
             throw std::runtime_error("invalid name for element");
 
         if (state & ExpectingAttribute)
-            out << ">";
-        out << "<" << name;
+            put('>');
+        put('<');
+        put(name);
 
-        elements.top().empty = false;
-        elements.push(ElementStatus{std::string(name), true});
+        elements.back().empty = false;
+        pushElement(name);
         state = ExpectingAttribute | ExpectingContent | ExpectingElement;
         return *this;
     }
@@ -117,23 +171,39 @@ struct XmlWriter
         if (elements.empty())
             throw std::runtime_error("no element to close");
 
-        ElementStatus const& element = elements.top();
-        if (element.empty)
-            out << "/>";
-        else
-            out << "</" << element.name << ">";
+        ElementStatus const& element = elements.back();
+        if (element.empty) {
+            put("/>");
+        }
+        else {
+            put("</");
+            put(std::string_view(names).substr(element.nameOffset));
+            put('>');
+        }
+        names.resize(element.nameOffset);
+        elements.pop_back();
 
-        elements.pop();
-        if (elements.empty())
+        if (elements.empty()) {
             state = Finished;
-        else
+            flush();
+        }
+        else {
             state = ExpectingContent | ExpectingElement;
-
+            if (buffer.size() >= FlushThreshold)
+                flush();
+        }
         return *this;
     }
 
+    void flush() {
+        if (buffer.empty())
+            return;
+        out.write(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+
     bool success() const {
-        return state == Finished && out.good();
+        return state == Finished && buffer.empty() && out.good();
     }
 
 private:
@@ -165,14 +235,52 @@ private:
         return true;
     }
 
+    void put(char c) {
+        buffer.push_back(c);
+    }
+
+    void put(std::string_view data) {
+        buffer.append(data);
+    }
+
+    void putValue(std::string_view data) {
+        XmlEscaped{data}.forEachRun([&](std::string_view run) {
+            buffer.append(run);
+        });
+    }
+
+    // characters are written as such rather than as their code
+    void putValue(char value) {
+        putValue(std::string_view(&value, 1));
+    }
+
+    template<typename Number>
+        requires std::is_arithmetic_v<Number> && (!std::is_same_v<Number, char>)
+    void putValue(Number value) {
+        char chars[64];
+        auto const [end, error] = std::to_chars(std::begin(chars), std::end(chars), value);
+        if (error != std::errc())
+            throw std::runtime_error("cannot format number");
+        buffer.append(chars, end);
+    }
+
+    void pushElement(std::string_view name) {
+        elements.push_back(ElementStatus{names.size(), true});
+        names.append(name);
+    }
+
+    // names of open elements are stacked in a single string, so that
+    // opening and closing elements does not allocate once warmed up
     struct ElementStatus
     {
-        std::string name;
+        size_t nameOffset;
         bool empty;
     };
 
     std::ostream& out;
-    std::stack<ElementStatus> elements;
+    std::string buffer;
+    std::string names;
+    std::vector<ElementStatus> elements;
     unsigned int state;
 };
 
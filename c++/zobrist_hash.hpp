@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023  Bilal Djelassi
+
+#ifndef ZOBRIST_HASH_HPP_INCLUDED
+#define ZOBRIST_HASH_HPP_INCLUDED
+
+#include "puzzle_types.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+
+// Key of a grid comparing the symbols of all cells, as Cells::key() does,
+// but hashed by a Zobrist hash maintained by the search instead of hashing
+// the cells.
+template<size_t CellsCount>
+struct ZobristKey
+{
+    uint64_t hash;
+    std::array<char, CellsCount> cells;
+
+    bool operator==(ZobristKey const&) const = default;
+};
+
+template<size_t CellsCount>
+struct std::hash<ZobristKey<CellsCount>>
+{
+    size_t operator()(ZobristKey<CellsCount> const& key) const {
+        return size_t(key.hash);
+    }
+};
+
+// Zobrist hashing of grids: a random value stands for each symbol on each
+// cell, and the hash of a grid is the XOR of the values of its non-empty
+// cells.  Moving a piece updates the hash by XOR-ing out the values of its
+// old cells and in the values of its new ones, and updates the same way the
+// hash of the mirror image of the grid, maintained alongside.  Symbols of
+// the cells of both images are maintained the same way, as a board checking
+// moves and keying grids without building Cells.
+template<typename Grid>
+struct ZobristHasher
+{
+    static constexpr size_t cellsCount = Grid::sizeX * Grid::sizeY;
+    static constexpr int SymbolsCount = 128;
+
+    struct Hashes {
+        uint64_t hash;
+        uint64_t mirrorHash;
+    };
+
+    // symbols of the cells of a grid and of its mirror image, row by row
+    struct Board {
+        std::array<char, cellsCount> cells;
+        std::array<char, cellsCount> mirrorCells;
+    };
+
+    using Key = ZobristKey<cellsCount>;
+
+    explicit ZobristHasher(uint64_t seed = 0x9e3779b97f4a7c15)
+    : values(cellsCount * SymbolsCount) {
+        // splitmix64 sequence
+        for (auto& value : values) {
+            seed += 0x9e3779b97f4a7c15;
+            uint64_t mixed = seed;
+            mixed = (mixed ^ (mixed >> 30)) * 0xbf58476d1ce4e5b9;
+            mixed = (mixed ^ (mixed >> 27)) * 0x94d049bb133111eb;
+            value = mixed ^ (mixed >> 31);
+        }
+    }
+
+    Hashes hashesOf(typename Grid::Cells const& cells) const {
+        Hashes hashes = {};
+        for (int y = 0; y < Grid::sizeY; ++y)
+            for (int x = 0; x < Grid::sizeX; ++x) {
+                char const symbol = cells[{x, y}].symbol;
+                if (symbol == PieceTag::empty().symbol)
+                    continue;
+                hashes.hash ^= valueOf({x, y}, symbol);
+                hashes.mirrorHash ^= valueOf(mirrored({x, y}), symbol);
+            }
+        return hashes;
+    }
+
+    static Board boardOf(typename Grid::Cells const& cells) {
+        Board board = {};
+        for (int y = 0; y < Grid::sizeY; ++y)
+            for (int x = 0; x < Grid::sizeX; ++x) {
+                char const symbol = cells[{x, y}].symbol;
+                board.cells[indexOf({x, y})] = symbol;
+                board.mirrorCells[indexOf(mirrored({x, y}))] = symbol;
+            }
+        return board;
+    }
+
+    // Hashes after moving a piece, given as it was before the move, which
+    // must be legal.
+    Hashes moved(Hashes hashes, Piece const& piece, Step const& step) const {
+        for (auto const& cell : piece.geom) {
+            Vect2 const from = piece.position + cell;
+            Vect2 const to = from + step.vector;
+            hashes.hash ^= valueOf(from, piece.tag.symbol) ^ valueOf(to, piece.tag.symbol);
+            hashes.mirrorHash ^= valueOf(mirrored(from), piece.tag.symbol)
+                               ^ valueOf(mirrored(to), piece.tag.symbol);
+        }
+        return hashes;
+    }
+
+    // Tells whether a piece of a board can be moved, its new cells being
+    // within the grid and either empty or its own.
+    static bool canMove(Board const& board, Piece const& piece, Step const& step) {
+        for (auto const& cell : piece.geom) {
+            Vect2 const to = piece.position + cell + step.vector;
+            if (to.x < 0 || to.x >= Grid::sizeX || to.y < 0 || to.y >= Grid::sizeY)
+                return false;
+            if (board.cells[indexOf(to)] == PieceTag::empty().symbol)
+                continue;
+            bool const isOwn = std::any_of(piece.geom.begin(), piece.geom.end(),
+                [&](Vect2 const& own) { return piece.position + own == to; });
+            if (!isOwn)
+                return false;
+        }
+        return true;
+    }
+
+    // Board after moving a piece, given as it was before the move, which
+    // must be legal.
+    static Board moved(Board board, Piece const& piece, Step const& step) {
+        for (auto const& cell : piece.geom) {
+            Vect2 const from = piece.position + cell;
+            board.cells[indexOf(from)] = PieceTag::empty().symbol;
+            board.mirrorCells[indexOf(mirrored(from))] = PieceTag::empty().symbol;
+        }
+        for (auto const& cell : piece.geom) {
+            Vect2 const to = piece.position + cell + step.vector;
+            board.cells[indexOf(to)] = piece.tag.symbol;
+            board.mirrorCells[indexOf(mirrored(to))] = piece.tag.symbol;
+        }
+        return board;
+    }
+
+    // Key of a grid, which with symmetry is shared with its mirror image by
+    // keeping the image of smallest hash, or of smallest cells on a tie.
+    static Key keyOf(Hashes const& hashes, Board const& board, typename Grid::KeySymmetry symmetry) {
+        if (symmetry == Grid::NoSymmetry || hashes.hash < hashes.mirrorHash)
+            return {hashes.hash, board.cells};
+        if (hashes.mirrorHash < hashes.hash)
+            return {hashes.mirrorHash, board.mirrorCells};
+        return {hashes.hash, std::min(board.cells, board.mirrorCells)};
+    }
+
+private:
+    static int indexOf(Vect2 const& position) {
+        return position.y * Grid::sizeX + position.x;
+    }
+
+    static Vect2 mirrored(Vect2 const& position) {
+        return {Grid::sizeX - 1 - position.x, position.y};
+    }
+
+    uint64_t valueOf(Vect2 const& position, char symbol) const {
+        return values[indexOf(position) * SymbolsCount + (symbol & (SymbolsCount - 1))];
+    }
+
+    std::vector<uint64_t> values;
+};
+
+#endif  // ZOBRIST_HASH_HPP_INCLUDED